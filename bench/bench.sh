@@ -0,0 +1,83 @@
+#!/bin/bash
+# make bench から呼ばれるベンチマーク
+# 各プログラムを RUNS 回ずつ実行し、ホスト時間の中央値・MIPS・命令数を出して baseline.txt と比べる
+#   ./bench.sh      比較して、THRESHOLD % より遅くなったものがあれば失敗
+#   ./bench.sh -u   baseline.txt を今回の結果で書き換える
+# baseline.txt の時間はマシン依存なので、比べるときは同じマシンで取り直したものを使うこと
+
+programs="fib matmul mandelbrot sieve readsum"
+RUNS=${RUNS:-5}
+THRESHOLD=${THRESHOLD:-10}
+
+cd "$(dirname "$0")"
+make -C .. build > /dev/null 2>&1 || { echo "build failed"; exit 1; }
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+
+update=0
+[ "$1" = "-u" ] && update=1
+
+# "name insts seconds"
+declare -A base_insts base_time
+if [ -f baseline.txt ]
+then
+    while read -r name insts sec
+    do
+        case "$name" in "#"*|"") continue ;; esac
+        base_insts[$name]=$insts
+        base_time[$name]=$sec
+    done < baseline.txt
+fi
+
+printf "%-12s %12s %10s %10s %10s %8s\n" program insts median MIPS baseline diff
+status=0
+result=""
+for p in $programs
+do
+    input=/dev/null
+    [ -f "$p.in" ] && input="$p.in"
+    times=""
+    for i in $(seq "$RUNS")
+    do
+        ../emu "$p.bin" h --hostperf="$tmp/hostperf.json" < "$input" > "$tmp/out" 2> /dev/null
+        if ! cmp -s "$tmp/out" "$p.out"
+        then
+            echo "$p: 出力が $p.out と一致しません"
+            exit 1
+        fi
+        insts=$(sed -n 's/.*"instructions": \([0-9]*\).*/\1/p' "$tmp/hostperf.json")
+        times="$times $(sed -n 's/.*"wall_seconds": \([0-9.]*\).*/\1/p' "$tmp/hostperf.json")"
+    done
+    median=$(echo $times | tr ' ' '\n' | sort -g | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }')
+    mips=$(awk -v n="$insts" -v t="$median" 'BEGIN { printf "%.2f", n / t / 1e6 }')
+    result="$result$p $insts $median\n"
+
+    base=${base_time[$p]}
+    if [ -z "$base" ]
+    then
+        printf "%-12s %12s %10s %10s %10s %8s\n" "$p" "$insts" "$median" "$mips" "-" "-"
+        continue
+    fi
+    diff=$(awk -v t="$median" -v b="$base" 'BEGIN { printf "%+.1f%%", (t / b - 1) * 100 }')
+    printf "%-12s %12s %10s %10s %10s %8s\n" "$p" "$insts" "$median" "$mips" "$base" "$diff"
+    if [ "$insts" != "${base_insts[$p]}" ]
+    then
+        echo "  $p: 命令数が変わりました (baseline ${base_insts[$p]})"
+    fi
+    if [ $update = 0 ] && awk -v t="$median" -v b="$base" -v th="$THRESHOLD" 'BEGIN { exit !(t > b * (1 + th / 100)) }'
+    then
+        echo -e "  \033[0;31m$p: ${THRESHOLD}% を超えて遅くなりました\033[0;39m"
+        status=1
+    fi
+done
+
+if [ $update = 1 ]
+then
+    {
+        echo "# program insts seconds (./bench.sh -u で更新)"
+        echo -e -n "$result"
+    } > baseline.txt
+    echo "baseline.txt を更新しました"
+fi
+exit $status
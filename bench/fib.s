@@ -0,0 +1,31 @@
+# 再帰のfib(27)
+.text
+_start:
+  li sp, 0x100000
+  li a0, 27
+  jal ra, fib
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+fib:
+  li t0, 2
+  blt a0, t0, 1f
+  addi sp, sp, -12
+  sw ra, 0(sp)
+  sw a0, 4(sp)
+  addi a0, a0, -1
+  jal ra, fib
+  sw a0, 8(sp)
+  lw a0, 4(sp)
+  addi a0, a0, -2
+  jal ra, fib
+  lw t1, 8(sp)
+  add a0, a0, t1
+  lw ra, 0(sp)
+  addi sp, sp, 12
+1:
+  ret
+
+.include "lib.s"
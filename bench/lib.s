@@ -0,0 +1,35 @@
+# ベンチマーク共通のルーチン (各プログラムの最後で .include する)
+
+# a0 を10進数でUARTに出す (符号なし)
+print_int:
+  addi sp, sp, -16
+  addi t1, sp, 16
+  li t2, 10
+1:
+  remu t3, a0, t2
+  divu a0, a0, t2
+  addi t3, t3, 48
+  addi t1, t1, -1
+  sb t3, 0(t1)
+  bnez a0, 1b
+  lui t4, 0x80000
+  addi t5, sp, 16
+2:
+  lbu t3, 0(t1)
+  sb t3, 4(t4)
+  addi t1, t1, 1
+  bne t1, t5, 2b
+  addi sp, sp, 16
+  ret
+
+# a0 の1文字をUARTに出す
+putc:
+  lui t4, 0x80000
+  sb a0, 4(t4)
+  ret
+
+# UARTから1文字読んで a0 に返す (EOFは0xff)
+getc:
+  lui t4, 0x80000
+  lbu a0, 0(t4)
+  ret
@@ -0,0 +1,59 @@
+# 80x40 のマンデルブロ集合 (最大500回反復) をUARTに出す
+.text
+_start:
+  li sp, 0x100000
+  li s0, 80           # 幅
+  li s1, 40           # 高さ
+  li s2, 500          # 最大反復回数
+  li t0, 4
+  fcvt.s.w f10, t0, rne   # 4.0
+  li t0, 80
+  fcvt.s.w f11, t0, rne   # 80.0
+  li t0, 100
+  fcvt.s.w f12, t0, rne   # 100.0
+
+  li s3, 0            # row
+row:
+  li t0, 6
+  mul t0, t0, s3
+  addi t0, t0, -120
+  fcvt.s.w f1, t0, rne
+  fdiv.s f1, f1, f12, rne # cy = (row*6-120)/100
+  li s4, 0            # col
+col:
+  li t0, 3
+  mul t0, t0, s4
+  addi t0, t0, -160
+  fcvt.s.w f0, t0, rne
+  fdiv.s f0, f0, f11, rne # cx = (col*3-160)/80
+  fcvt.s.w f2, zero, rne  # zr
+  fcvt.s.w f3, zero, rne  # zi
+  li t1, 0
+iter:
+  fmul.s f4, f2, f2, rne
+  fmul.s f5, f3, f3, rne
+  fadd.s f6, f4, f5, rne
+  flt.s t2, f10, f6
+  bnez t2, outside
+  fmul.s f7, f2, f3, rne
+  fadd.s f7, f7, f7, rne
+  fadd.s f3, f7, f1, rne
+  fsub.s f2, f4, f5, rne
+  fadd.s f2, f2, f0, rne
+  addi t1, t1, 1
+  blt t1, s2, iter
+  li a0, 42           # '*'
+  j put
+outside:
+  li a0, 32           # ' '
+put:
+  jal ra, putc
+  addi s4, s4, 1
+  blt s4, s0, col
+  li a0, 10
+  jal ra, putc
+  addi s3, s3, 1
+  blt s3, s1, row
+  .word 0
+
+.include "lib.s"
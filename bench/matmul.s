@@ -0,0 +1,81 @@
+# 64x64 の単精度行列積を4回 (A[i][j] = i+j, B[i][j] = i-j)
+# C の全要素を整数にして足したものを出す
+.text
+_start:
+  li sp, 0x100000
+  li s0, 64           # N
+  li s4, 0x200000     # A
+  li s5, 0x210000     # B
+  li s6, 0x220000     # C
+
+  # 初期化
+  li s1, 0
+  mv t0, s4
+  mv t1, s5
+init_i:
+  li s2, 0
+init_j:
+  add t2, s1, s2
+  fcvt.s.w f1, t2, rne
+  fsw f1, 0(t0)
+  sub t2, s1, s2
+  fcvt.s.w f2, t2, rne
+  fsw f2, 0(t1)
+  addi t0, t0, 4
+  addi t1, t1, 4
+  addi s2, s2, 1
+  blt s2, s0, init_j
+  addi s1, s1, 1
+  blt s1, s0, init_i
+
+  li s8, 4
+rep:
+  li s1, 0
+iloop:
+  li s2, 0
+jloop:
+  fcvt.s.w f0, zero, rne
+  li s3, 0
+  mul t0, s1, s0
+  slli t0, t0, 2
+  add t0, t0, s4
+  slli t1, s2, 2
+  add t1, t1, s5
+kloop:
+  flw f1, 0(t0)
+  flw f2, 0(t1)
+  fmul.s f3, f1, f2, rne
+  fadd.s f0, f0, f3, rne
+  addi t0, t0, 4
+  addi t1, t1, 256
+  addi s3, s3, 1
+  blt s3, s0, kloop
+  mul t2, s1, s0
+  add t2, t2, s2
+  slli t2, t2, 2
+  add t2, t2, s6
+  fsw f0, 0(t2)
+  addi s2, s2, 1
+  blt s2, s0, jloop
+  addi s1, s1, 1
+  blt s1, s0, iloop
+  addi s8, s8, -1
+  bnez s8, rep
+
+  # チェックサム
+  li a0, 0
+  mv t0, s6
+  mul t1, s0, s0
+sum:
+  flw f1, 0(t0)
+  fcvt.w.s t2, f1, rne
+  add a0, a0, t2
+  addi t0, t0, 4
+  addi t1, t1, -1
+  bnez t1, sum
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+.include "lib.s"
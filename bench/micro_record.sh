@@ -0,0 +1,17 @@
+#!/bin/bash
+# bench/ のプログラムを --trace 付きで実行して、microbench の入力 (micro_inputs.txt) を取り直す
+cd "$(dirname "$0")"
+make -C .. build microbench > /dev/null 2>&1 || { echo "build failed"; exit 1; }
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+
+traces=""
+for p in fib matmul mandelbrot sieve readsum
+do
+    input=/dev/null
+    [ -f "$p.in" ] && input="$p.in"
+    ../emu "$p.bin" h --trace="$tmp/$p.tr" --trace-compress=1 < "$input" > /dev/null 2>&1
+    traces="$traces $tmp/$p.tr"
+done
+../microbench record micro_inputs.txt $traces
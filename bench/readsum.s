@@ -0,0 +1,42 @@
+# UARTから改行区切りの整数をEOFまで読み、個数と合計を出す
+.text
+_start:
+  li sp, 0x100000
+  li s0, 0            # 個数
+  li s1, 0            # 合計
+  li s2, 0            # 読んでいる数
+  li s3, 0            # 数字を読んだか
+  li s4, 255          # EOF
+loop:
+  jal ra, getc
+  beq a0, s4, done
+  addi t0, a0, -48
+  li t1, 10
+  bgeu t0, t1, sep
+  mul s2, s2, t1
+  add s2, s2, t0
+  li s3, 1
+  j loop
+sep:
+  beqz s3, loop
+  add s1, s1, s2
+  addi s0, s0, 1
+  li s2, 0
+  li s3, 0
+  j loop
+done:
+  beqz s3, 1f
+  add s1, s1, s2
+  addi s0, s0, 1
+1:
+  mv a0, s0
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  mv a0, s1
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+.include "lib.s"
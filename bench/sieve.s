@@ -0,0 +1,45 @@
+# エラトステネスの篩で 1000000 未満の素数を数える
+.text
+_start:
+  li sp, 0x100000
+  li s0, 1000000
+  li s1, 0x200000     # フラグ配列
+  li t0, 0
+  li t1, 1
+init:
+  add t2, s1, t0
+  sb t1, 0(t2)
+  addi t0, t0, 1
+  blt t0, s0, init
+
+  li s2, 2            # p
+outer:
+  mul t0, s2, s2
+  bge t0, s0, count
+  add t2, s1, s2
+  lbu t1, 0(t2)
+  beqz t1, next
+mark:
+  add t2, s1, t0
+  sb zero, 0(t2)
+  add t0, t0, s2
+  blt t0, s0, mark
+next:
+  addi s2, s2, 1
+  j outer
+
+count:
+  li a0, 0
+  li t0, 2
+cloop:
+  add t2, s1, t0
+  lbu t1, 0(t2)
+  add a0, a0, t1
+  addi t0, t0, 1
+  blt t0, s0, cloop
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+.include "lib.s"
@@ -0,0 +1,263 @@
+// 分岐予測器のシミュレーション
+// 条件分岐は有効な全ての予測器に流し、jalrの戻りはリターンアドレススタックで予測する
+class Predictor
+{
+  public:
+    std::string name;
+    uint64_t mispredicts;
+    Predictor(const std::string &name) : name(name), mispredicts(0) {}
+    virtual ~Predictor() {}
+    virtual bool predict(uint32_t pc, uint32_t target) = 0;
+    virtual void update(uint32_t pc, bool taken) = 0;
+};
+
+// 後方分岐は成立、前方分岐は不成立と予測する
+class StaticBTFN : public Predictor
+{
+  public:
+    StaticBTFN() : Predictor("btfn") {}
+    bool predict(uint32_t pc, uint32_t target)
+    {
+        return target < pc;
+    }
+    void update(uint32_t, bool) {}
+};
+
+// 2bit飽和カウンタのテーブル
+class CounterTable
+{
+    std::vector<uint8_t> counters;
+    uint32_t mask;
+
+  public:
+    CounterTable(uint32_t bits) : counters(1 << bits, 1), mask((1 << bits) - 1) {}
+    bool predict(uint32_t index)
+    {
+        return counters[index & mask] >= 2;
+    }
+    void update(uint32_t index, bool up)
+    {
+        uint8_t &c = counters[index & mask];
+        if (up && c < 3)
+            c++;
+        else if (!up && c > 0)
+            c--;
+    }
+};
+
+class Bimodal : public Predictor
+{
+    CounterTable table;
+
+  public:
+    Bimodal(uint32_t bits) : Predictor("bimodal"), table(bits) {}
+    bool predict(uint32_t pc, uint32_t)
+    {
+        return table.predict(pc >> 2);
+    }
+    void update(uint32_t pc, bool taken)
+    {
+        table.update(pc >> 2, taken);
+    }
+};
+
+class Gshare : public Predictor
+{
+    CounterTable table;
+    uint32_t history;
+    uint32_t history_mask;
+
+  public:
+    Gshare(uint32_t bits, uint32_t history_bits)
+        : Predictor("gshare"), table(bits), history(0), history_mask((1 << history_bits) - 1) {}
+    bool predict(uint32_t pc, uint32_t)
+    {
+        return table.predict((pc >> 2) ^ history);
+    }
+    void update(uint32_t pc, bool taken)
+    {
+        table.update((pc >> 2) ^ history, taken);
+        history = ((history << 1) | taken) & history_mask;
+    }
+};
+
+// bimodal と gshare を選択用のカウンタで切り替える
+class Tournament : public Predictor
+{
+    Bimodal local;
+    Gshare global;
+    CounterTable chooser; // 2以上ならgshare
+    bool local_pred;
+    bool global_pred;
+
+  public:
+    Tournament(uint32_t bits, uint32_t history_bits)
+        : Predictor("tournament"), local(bits), global(bits, history_bits), chooser(bits) {}
+    bool predict(uint32_t pc, uint32_t target)
+    {
+        local_pred = local.predict(pc, target);
+        global_pred = global.predict(pc, target);
+        return chooser.predict(pc >> 2) ? global_pred : local_pred;
+    }
+    void update(uint32_t pc, bool taken)
+    {
+        if (local_pred != global_pred)
+        {
+            chooser.update(pc >> 2, global_pred == taken);
+        }
+        local.update(pc, taken);
+        global.update(pc, taken);
+    }
+};
+
+class BranchPredictors
+{
+    struct BranchStat
+    {
+        uint64_t count;
+        uint64_t taken;
+        std::vector<uint64_t> mispredicts;
+    };
+
+    std::vector<Predictor *> predictors;
+    std::unordered_map<uint32_t, BranchStat> branches;
+    uint64_t branch_count;
+
+    // リターンアドレススタック (溢れたら古いものから捨てる)
+    std::vector<uint32_t> ras;
+    size_t ras_top;
+    size_t ras_used;
+    uint64_t returns;
+    uint64_t ras_mispredicts;
+
+  public:
+    BranchPredictors(const std::string &list, uint32_t bits, uint32_t history_bits, uint32_t ras_depth)
+        : ras(ras_depth == 0 ? 1 : ras_depth, 0)
+    {
+        std::string l = list + ",";
+        size_t p = 0, q;
+        while ((q = l.find(',', p)) != std::string::npos)
+        {
+            std::string n = l.substr(p, q - p);
+            p = q + 1;
+            if (n == "btfn" || n == "all")
+                predictors.push_back(new StaticBTFN());
+            if (n == "bimodal" || n == "all")
+                predictors.push_back(new Bimodal(bits));
+            if (n == "gshare" || n == "all")
+                predictors.push_back(new Gshare(bits, history_bits));
+            if (n == "tournament" || n == "all")
+                predictors.push_back(new Tournament(bits, history_bits));
+            if (n != "btfn" && n != "bimodal" && n != "gshare" && n != "tournament" && n != "all" && n != "")
+                error_dump("知らない分岐予測器です: %s\n", n.c_str());
+        }
+        branch_count = 0;
+        ras_top = 0;
+        ras_used = 0;
+        returns = 0;
+        ras_mispredicts = 0;
+    }
+    ~BranchPredictors()
+    {
+        for (Predictor *p : predictors)
+        {
+            delete p;
+        }
+    }
+
+    void branch(uint32_t pc, uint32_t target, bool taken)
+    {
+        BranchStat &bs = branches[pc];
+        if (bs.mispredicts.empty())
+        {
+            bs.mispredicts.assign(predictors.size(), 0);
+        }
+        bs.count++;
+        bs.taken += taken;
+        branch_count++;
+        for (size_t i = 0; i < predictors.size(); i++)
+        {
+            if (predictors[i]->predict(pc, target) != taken)
+            {
+                predictors[i]->mispredicts++;
+                bs.mispredicts[i]++;
+            }
+            predictors[i]->update(pc, taken);
+        }
+    }
+
+    void call(uint32_t ret)
+    {
+        ras_top = (ras_top + 1) % ras.size();
+        ras[ras_top] = ret;
+        ras_used = std::min(ras_used + 1, ras.size());
+    }
+
+    void ret(uint32_t target)
+    {
+        returns++;
+        if (ras_used == 0 || ras[ras_top] != target)
+        {
+            ras_mispredicts++;
+        }
+        if (ras_used > 0)
+        {
+            ras_top = (ras_top + ras.size() - 1) % ras.size();
+            ras_used--;
+        }
+    }
+
+    void write(const std::string &filename, uint64_t inst_count, size_t top)
+    {
+        FILE *fp = fopen(filename.c_str(), "w");
+        if (fp == nullptr)
+        {
+            warn_dump("%s を開けませんでした\n", filename.c_str());
+            return;
+        }
+        double kinst = inst_count / 1000.0;
+        fprintf(fp, "# instructions %llu, conditional branches %llu, static branches %zu\n",
+                (unsigned long long)inst_count, (unsigned long long)branch_count, branches.size());
+        for (Predictor *p : predictors)
+        {
+            fprintf(fp, "%-10s mispredicts %12llu  accuracy %8.4f%%  MPKI %8.4f\n", p->name.c_str(),
+                    (unsigned long long)p->mispredicts,
+                    branch_count == 0 ? 100.0 : 100.0 - 100.0 * p->mispredicts / branch_count,
+                    kinst == 0 ? 0.0 : p->mispredicts / kinst);
+        }
+        fprintf(fp, "%-10s mispredicts %12llu  accuracy %8.4f%%  MPKI %8.4f  (returns %llu)\n", "ras",
+                (unsigned long long)ras_mispredicts,
+                returns == 0 ? 100.0 : 100.0 - 100.0 * ras_mispredicts / returns,
+                kinst == 0 ? 0.0 : ras_mispredicts / kinst, (unsigned long long)returns);
+
+        // 全予測器のミス数の合計が多い順
+        std::vector<std::pair<uint32_t, BranchStat>> bs(branches.begin(), branches.end());
+        auto total = [](const BranchStat &s) {
+            uint64_t t = 0;
+            for (uint64_t m : s.mispredicts)
+                t += m;
+            return t;
+        };
+        std::sort(bs.begin(), bs.end(), [&](const std::pair<uint32_t, BranchStat> &a, const std::pair<uint32_t, BranchStat> &b) {
+            uint64_t ta = total(a.second), tb = total(b.second);
+            return ta == tb ? a.first < b.first : ta > tb;
+        });
+        fprintf(fp, "\n#     pc        count    taken%%");
+        for (Predictor *p : predictors)
+        {
+            fprintf(fp, " %12s", p->name.c_str());
+        }
+        fprintf(fp, "\n");
+        for (size_t i = 0; i < bs.size() && i < top; i++)
+        {
+            const BranchStat &s = bs[i].second;
+            fprintf(fp, "%08x %12llu %8.3f", bs[i].first, (unsigned long long)s.count, 100.0 * s.taken / s.count);
+            for (uint64_t m : s.mispredicts)
+            {
+                fprintf(fp, " %12llu", (unsigned long long)m);
+            }
+            fprintf(fp, "\n");
+        }
+        fclose(fp);
+    }
+};
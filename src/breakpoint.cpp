@@ -0,0 +1,73 @@
+// 実行のブレークポイントの集合
+// 命令毎に引くので、仮想ページ毎の1bitでブレークポイントのないページならすぐに返す
+class Breakpoints
+{
+    static const uint32_t pages = 1 << 20;
+    std::vector<uint64_t> page_bits;
+    std::vector<uint32_t> ips; // 昇順
+
+  public:
+    Breakpoints() : page_bits(pages / 64) {}
+
+    void add(uint32_t ip)
+    {
+        uint32_t page = ip >> 12;
+        page_bits[page / 64] |= 1ull << (page % 64);
+        ips.insert(std::upper_bound(ips.begin(), ips.end(), ip), ip);
+    }
+
+    void remove(uint32_t ip)
+    {
+        auto it = std::lower_bound(ips.begin(), ips.end(), ip);
+        if (it == ips.end() || *it != ip)
+        {
+            return;
+        }
+        it = ips.erase(it);
+        // 同じページに他のブレークポイントがなければページのビットを下ろす
+        uint32_t page = ip >> 12;
+        bool left = (it != ips.end() && *it >> 12 == page) || (it != ips.begin() && *(it - 1) >> 12 == page);
+        if (!left)
+        {
+            page_bits[page / 64] &= ~(1ull << (page % 64));
+        }
+    }
+
+    // ip のページにブレークポイントがあるか
+    bool on_page(uint32_t ip)
+    {
+        uint32_t page = ip >> 12;
+        return (page_bits[page / 64] >> (page % 64)) & 1;
+    }
+
+    bool hit(uint32_t ip)
+    {
+        return on_page(ip) && std::binary_search(ips.begin(), ips.end(), ip);
+    }
+
+    // "ADDR[:LEN][:r|w|rw]" (LEN はバイト数でデフォルト4、デフォルトは w)
+    static Watchpoint parse_watch(const std::string &spec)
+    {
+        Watchpoint w = {0, 4, false, true, 0};
+        size_t colon = spec.find(':');
+        w.start = w.vaddr = strtoul(spec.substr(0, colon).c_str(), NULL, 0);
+        std::string rest = colon == std::string::npos ? "" : spec.substr(colon + 1);
+        if (rest != "" && isdigit(rest[0]))
+        {
+            colon = rest.find(':');
+            w.len = strtoul(rest.substr(0, colon).c_str(), NULL, 0);
+            rest = colon == std::string::npos ? "" : rest.substr(colon + 1);
+        }
+        if (rest != "")
+        {
+            w.read = rest.find('r') != std::string::npos;
+            w.write = rest.find('w') != std::string::npos;
+        }
+        // 2^32 を越える範囲は受け付けない
+        if (w.len == 0 || (uint64_t)w.start + w.len > 1ull << 32 || (!w.read && !w.write))
+        {
+            error_dump("ウォッチポイントの指定がおかしいです: %s\n", spec.c_str());
+        }
+        return w;
+    }
+};
@@ -0,0 +1,275 @@
+// ターゲットのキャッシュ階層のシミュレータ
+// Memory から物理アドレスでのアクセスを受け取り、レベル毎・PC毎のヒット率を数える
+class CacheLevel
+{
+    uint32_t line_shift;
+    uint32_t set_mask;
+    std::vector<uint32_t> tags;
+    std::vector<uint64_t> last_used; // 0 なら無効
+    std::vector<bool> dirty;
+    uint64_t clock;
+
+  public:
+    std::string name;
+    uint32_t size;
+    uint32_t assoc;
+    uint32_t line;
+    bool write_back; // write-back + write-allocate / write-through + no-write-allocate
+
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_misses;
+    uint64_t write_misses;
+    uint64_t writebacks;
+
+    CacheLevel(const std::string &name, uint32_t size, uint32_t assoc, uint32_t line, bool write_back)
+    {
+        this->name = name;
+        this->size = size;
+        this->assoc = assoc;
+        this->line = line;
+        this->write_back = write_back;
+        if (size == 0)
+        {
+            return;
+        }
+        if (line < 4 || (line & (line - 1)) != 0 || assoc == 0 || size % (assoc * line) != 0 ||
+            ((size / assoc / line) & (size / assoc / line - 1)) != 0)
+        {
+            error_dump("キャッシュの設定がおかしいです(%s): size %u, assoc %u, line %u\n", name.c_str(), size, assoc, line);
+        }
+        line_shift = __builtin_ctz(line);
+        uint32_t sets = size / assoc / line;
+        set_mask = sets - 1;
+        tags.assign(sets * assoc, 0);
+        last_used.assign(sets * assoc, 0);
+        dirty.assign(sets * assoc, false);
+        clock = 0;
+        reads = writes = read_misses = write_misses = writebacks = 0;
+    }
+
+    bool enabled()
+    {
+        return size != 0;
+    }
+
+    // ヒットしたらtrue
+    // 追い出した行が dirty なら *victim にそのアドレスを入れる
+    bool access(uint32_t addr, bool write, bool *evicted, uint32_t *victim)
+    {
+        *evicted = false;
+        write ? writes++ : reads++;
+        uint32_t block = addr >> line_shift;
+        uint32_t base = (block & set_mask) * assoc;
+        uint32_t tag = block >> __builtin_ctz(set_mask + 1);
+        clock++;
+
+        uint32_t lru = base;
+        for (uint32_t w = base; w < base + assoc; w++)
+        {
+            if (last_used[w] != 0 && tags[w] == tag)
+            {
+                last_used[w] = clock;
+                if (write && write_back)
+                {
+                    dirty[w] = true;
+                }
+                return true;
+            }
+            if (last_used[w] < last_used[lru])
+            {
+                lru = w;
+            }
+        }
+
+        write ? write_misses++ : read_misses++;
+        if (write && !write_back)
+        {
+            return false;
+        }
+        if (last_used[lru] != 0 && dirty[lru])
+        {
+            *evicted = true;
+            *victim = ((tags[lru] << __builtin_ctz(set_mask + 1)) | (block & set_mask)) << line_shift;
+            writebacks++;
+        }
+        tags[lru] = tag;
+        last_used[lru] = clock;
+        dirty[lru] = write;
+        return false;
+    }
+
+    void report(FILE *fp)
+    {
+        if (!enabled())
+        {
+            return;
+        }
+        uint64_t accesses = reads + writes;
+        uint64_t misses = read_misses + write_misses;
+        fprintf(fp, "%-4s %7uB %2u-way %3uB %s: accesses %llu, misses %llu (read %llu, write %llu), miss rate %.4f%%, writebacks %llu\n",
+                name.c_str(), size, assoc, line, write_back ? "wb" : "wt",
+                (unsigned long long)accesses, (unsigned long long)misses,
+                (unsigned long long)read_misses, (unsigned long long)write_misses,
+                accesses == 0 ? 0.0 : 100.0 * misses / accesses, (unsigned long long)writebacks);
+    }
+};
+
+class CacheSim
+{
+    struct PcStat
+    {
+        uint64_t accesses;
+        uint64_t l1_misses;
+        uint64_t l2_misses;
+    };
+
+    CacheLevel l1i;
+    CacheLevel l1d;
+    CacheLevel l2;
+    uint32_t l1_latency;
+    uint32_t l2_latency;
+    uint32_t mem_latency;
+    std::unordered_map<uint32_t, PcStat> pc_stats;
+
+    uint32_t access(CacheLevel &l1, uint32_t addr, bool write)
+    {
+        bool evicted, e2;
+        uint32_t victim, v2;
+        PcStat &ps = pc_stats[pc];
+        ps.accesses++;
+        bool hit = l1.access(addr, write, &evicted, &victim);
+        if (!hit)
+        {
+            ps.l1_misses++;
+        }
+        if (evicted && l2.enabled())
+        {
+            l2.access(victim, true, &e2, &v2);
+        }
+        // write-through の書き込みはヒットしても下のレベルに流す (書き込みバッファで隠れる)
+        bool write_through = write && !l1.write_back;
+        if (hit && !write_through)
+        {
+            return l1_latency;
+        }
+        if (!l2.enabled())
+        {
+            if (hit)
+            {
+                return l1_latency;
+            }
+            ps.l2_misses++;
+            return l1_latency + mem_latency;
+        }
+        bool hit2 = l2.access(addr, write_through, &e2, &v2);
+        if (hit)
+        {
+            return l1_latency;
+        }
+        if (hit2)
+        {
+            return l1_latency + l2_latency;
+        }
+        ps.l2_misses++;
+        return l1_latency + l2_latency + mem_latency;
+    }
+
+    static uint32_t parse_size(const std::string &s)
+    {
+        char *end;
+        uint32_t v = strtoul(s.c_str(), &end, 0);
+        if (*end == 'k' || *end == 'K')
+        {
+            v <<= 10;
+        }
+        else if (*end == 'm' || *end == 'M')
+        {
+            v <<= 20;
+        }
+        return v;
+    }
+
+  public:
+    // 今実行している命令のPC
+    uint32_t pc;
+
+    // SIZE:ASSOC:LINE[:wb|wt] の形式
+    static CacheLevel parse_level(const std::string &name, const std::string &conf)
+    {
+        std::vector<std::string> f;
+        size_t p = 0;
+        while (1)
+        {
+            size_t q = conf.find(':', p);
+            f.push_back(conf.substr(p, q == std::string::npos ? std::string::npos : q - p));
+            if (q == std::string::npos)
+            {
+                break;
+            }
+            p = q + 1;
+        }
+        if (f.size() < 3 && !(f.size() == 1 && parse_size(f[0]) == 0))
+        {
+            error_dump("キャッシュの設定は SIZE:ASSOC:LINE[:wb|wt] です(%s): %s\n", name.c_str(), conf.c_str());
+        }
+        if (f.size() < 3)
+        {
+            return CacheLevel(name, 0, 1, 4, true);
+        }
+        return CacheLevel(name, parse_size(f[0]), parse_size(f[1]), parse_size(f[2]), f.size() < 4 || f[3] != "wt");
+    }
+
+    CacheSim(const CacheLevel &l1i, const CacheLevel &l1d, const CacheLevel &l2,
+             uint32_t l1_latency, uint32_t l2_latency, uint32_t mem_latency)
+        : l1i(l1i), l1d(l1d), l2(l2)
+    {
+        this->l1_latency = l1_latency;
+        this->l2_latency = l2_latency;
+        this->mem_latency = mem_latency;
+        pc = 0;
+    }
+
+    // それぞれアクセスにかかるサイクル数を返す
+    uint32_t fetch(uint32_t addr)
+    {
+        return access(l1i, addr, false);
+    }
+    uint32_t load(uint32_t addr)
+    {
+        return access(l1d, addr, false);
+    }
+    uint32_t store(uint32_t addr)
+    {
+        return access(l1d, addr, true);
+    }
+
+    void write(const std::string &filename, size_t top)
+    {
+        FILE *fp = fopen(filename.c_str(), "w");
+        if (fp == nullptr)
+        {
+            warn_dump("%s を開けませんでした\n", filename.c_str());
+            return;
+        }
+        fprintf(fp, "# latency: l1 %u, l2 %u, memory %u\n", l1_latency, l2_latency, mem_latency);
+        l1i.report(fp);
+        l1d.report(fp);
+        l2.report(fp);
+
+        std::vector<std::pair<uint32_t, PcStat>> ps(pc_stats.begin(), pc_stats.end());
+        std::sort(ps.begin(), ps.end(), [](const std::pair<uint32_t, PcStat> &a, const std::pair<uint32_t, PcStat> &b) {
+            return a.second.l1_misses == b.second.l1_misses ? a.first < b.first : a.second.l1_misses > b.second.l1_misses;
+        });
+        fprintf(fp, "\n# pc (fetch and data accesses)\n");
+        fprintf(fp, "#     pc     accesses    l1 misses  l1 miss%%    l2 misses\n");
+        for (size_t i = 0; i < ps.size() && i < top; i++)
+        {
+            const PcStat &s = ps[i].second;
+            fprintf(fp, "%08x %12llu %12llu %9.3f %12llu\n", ps[i].first,
+                    (unsigned long long)s.accesses, (unsigned long long)s.l1_misses,
+                    100.0 * s.l1_misses / s.accesses, (unsigned long long)s.l2_misses);
+        }
+        fclose(fp);
+    }
+};
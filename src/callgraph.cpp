@@ -0,0 +1,262 @@
+// jal/jalrの呼び出しと戻りから呼び出しコンテキスト木を作るプロファイラ
+// 呼び出し: rd == x1 の jal/jalr
+// 戻り:     jalr x0, 0(x1)
+// トラップ: stvec への遷移で積み、sret で降ろす
+class CallGraph
+{
+    static const size_t max_depth = 4096;
+
+    struct Node
+    {
+        uint32_t func;
+        bool trap;
+        Node *parent;
+        uint64_t self;
+        uint64_t calls;
+        std::map<uint64_t, Node *> children;
+        Node(uint32_t func, bool trap, Node *parent)
+            : func(func), trap(trap), parent(parent), self(0), calls(0) {}
+        ~Node()
+        {
+            for (auto &c : children)
+            {
+                delete c.second;
+            }
+        }
+    };
+
+    struct Frame
+    {
+        Node *node;
+        uint32_t ret;
+    };
+
+    struct FuncStat
+    {
+        uint64_t calls;
+        uint64_t inclusive;
+        uint64_t exclusive;
+    };
+
+    Node *root;
+    Node *cur;
+    // 今実行している命令を数える関数 (呼び出しや戻りで cur が変わる前のもの)
+    Node *executing;
+    std::vector<Frame> stack;
+    // max_depthを超えた呼び出しの数 (木には積まない)
+    uint64_t overflow;
+
+    void push(uint32_t func, uint32_t ret, bool trap)
+    {
+        if (stack.size() >= max_depth)
+        {
+            overflow++;
+            return;
+        }
+        uint64_t key = ((uint64_t)trap << 32) | func;
+        Node *&child = cur->children[key];
+        if (child == nullptr)
+        {
+            child = new Node(func, trap, cur);
+        }
+        if (!muted)
+        {
+            child->calls++;
+        }
+        stack.push_back({cur, ret});
+        cur = child;
+    }
+
+    std::string name(Node *n)
+    {
+        std::string sym = symbols ? symbols->describe(n->func) : "";
+        if (sym != "")
+        {
+            return n->trap ? "[trap]" + sym : sym;
+        }
+        char buf[32];
+        snprintf(buf, sizeof(buf), n->trap ? "[trap]0x%08x" : "0x%08x", n->func);
+        return buf;
+    }
+
+    uint64_t collect(Node *n, std::string path, std::map<uint32_t, int> &on_path,
+                     std::map<uint32_t, FuncStat> &funcs, FILE *folded)
+    {
+        path += name(n);
+        if (n->self != 0)
+        {
+            fprintf(folded, "%s %llu\n", path.c_str(), (unsigned long long)n->self);
+        }
+        on_path[n->func]++;
+        uint64_t total = n->self;
+        for (auto &c : n->children)
+        {
+            total += collect(c.second, path + ";", on_path, funcs, folded);
+        }
+        on_path[n->func]--;
+
+        FuncStat &f = funcs[n->func];
+        f.calls += n->calls;
+        f.exclusive += n->self;
+        // 再帰しているときは一番外側の呼び出しだけを数える
+        if (on_path[n->func] == 0)
+        {
+            f.inclusive += total;
+        }
+        return total;
+    }
+
+  public:
+    // あれば関数をシンボルの名前で出す
+    SymbolTable *symbols;
+    // 逆実行で一度数えた所を実行し直している間は数えない (積み降ろしはする)
+    bool muted;
+
+    // チェックポイントに残すもの (木の節は消さないのでポインタのままでよい)
+    struct State
+    {
+        Node *cur;
+        std::vector<Frame> stack;
+        uint64_t overflow;
+    };
+    State state()
+    {
+        return {cur, stack, overflow};
+    }
+    void restore(const State &s)
+    {
+        cur = s.cur;
+        stack = s.stack;
+        overflow = s.overflow;
+    }
+
+    CallGraph(uint32_t entry)
+    {
+        symbols = nullptr;
+        muted = false;
+        root = new Node(entry, false, nullptr);
+        root->calls = 1;
+        cur = root;
+        executing = root;
+        overflow = 0;
+    }
+    ~CallGraph()
+    {
+        delete root;
+    }
+
+    // プログラムを読み込んでからエントリポイントを決める
+    void set_entry(uint32_t entry)
+    {
+        root->func = entry;
+    }
+
+    // 今実行している関数の先頭アドレス
+    uint32_t current()
+    {
+        return cur->func;
+    }
+
+    // 命令の実行を始める
+    void begin()
+    {
+        executing = cur;
+    }
+
+    // begin した命令がリタイアした
+    void tick()
+    {
+        if (!muted)
+        {
+            executing->self++;
+        }
+    }
+
+    void call(uint32_t target, uint32_t ret)
+    {
+        push(target, ret, false);
+    }
+
+    void ret(uint32_t target)
+    {
+        if (overflow > 0)
+        {
+            overflow--;
+            return;
+        }
+        // 戻り先が一致するフレームまで巻き戻す (末尾呼び出しや大域脱出への対策)
+        Node *entered = cur;
+        for (size_t i = stack.size(); i > 0; i--)
+        {
+            // トラップハンドラの外には戻れない
+            if (entered->trap)
+            {
+                break;
+            }
+            if (stack[i - 1].ret == target)
+            {
+                cur = stack[i - 1].node;
+                stack.resize(i - 1);
+                return;
+            }
+            entered = stack[i - 1].node;
+        }
+    }
+
+    void trap_enter(uint32_t handler, uint32_t epc)
+    {
+        push(handler, epc, true);
+    }
+
+    void trap_exit()
+    {
+        while (!stack.empty())
+        {
+            bool trap = cur->trap;
+            cur = stack.back().node;
+            stack.pop_back();
+            if (trap)
+            {
+                return;
+            }
+        }
+    }
+
+    // prefix.folded: flamegraph.pl 等が読める collapsed stack 形式
+    // prefix.funcs:  関数ごとの呼び出し回数 / inclusive / exclusive 命令数
+    void write(const std::string &prefix)
+    {
+        FILE *folded = fopen((prefix + ".folded").c_str(), "w");
+        if (folded == nullptr)
+        {
+            warn_dump("%s.folded を開けませんでした\n", prefix.c_str());
+            return;
+        }
+        std::map<uint32_t, int> on_path;
+        std::map<uint32_t, FuncStat> funcs;
+        uint64_t total = collect(root, "", on_path, funcs, folded);
+        fclose(folded);
+
+        std::vector<std::pair<uint32_t, FuncStat>> fs(funcs.begin(), funcs.end());
+        std::sort(fs.begin(), fs.end(), [](const std::pair<uint32_t, FuncStat> &a, const std::pair<uint32_t, FuncStat> &b) {
+            return a.second.inclusive == b.second.inclusive ? a.first < b.first : a.second.inclusive > b.second.inclusive;
+        });
+        FILE *out = fopen((prefix + ".funcs").c_str(), "w");
+        if (out == nullptr)
+        {
+            warn_dump("%s.funcs を開けませんでした\n", prefix.c_str());
+            return;
+        }
+        fprintf(out, "# total: %llu\n", (unsigned long long)total);
+        fprintf(out, "#     func        calls    inclusive   incl%%    exclusive   excl%%  symbol\n");
+        for (auto &f : fs)
+        {
+            fprintf(out, "0x%08x %12llu %12llu %7.3f %12llu %7.3f  %s\n", f.first,
+                    (unsigned long long)f.second.calls,
+                    (unsigned long long)f.second.inclusive, 100.0 * f.second.inclusive / total,
+                    (unsigned long long)f.second.exclusive, 100.0 * f.second.exclusive / total,
+                    symbols ? symbols->describe(f.first).c_str() : "");
+        }
+        fclose(out);
+    }
+};
@@ -0,0 +1,114 @@
+// 逆実行のためのチェックポイント
+// interval 命令毎にレジスタ・CSR・タイマなどを残す。メモリは丸ごとは写さず、
+// 次のチェックポイントまでに初めて書き込まれたページの元の中身だけを残す (PAGE_SNAPSHOT)
+// k 番目に戻るときは、新しい方から k 番目までに残したページを順に書き戻す
+// 命令毎の実行回数 (Stat) も戻す。プロファイラと呼び出しコンテキスト木の回数は大きいので戻さず、
+// 一度実行した所 (high_water まで) を実行し直す間は数えない
+struct Checkpoint
+{
+    unsigned long long inst_count;
+    uint32_t regs[Register::file_size];
+    uint32_t ip;
+    std::vector<uint32_t> csrs; // Core の CSR の表の順
+    uint32_t satp;
+    int mode;
+    uint64_t mtime;
+    uint64_t mtimecmp;
+    uint8_t led;
+    InputLog::Mark input;
+    ProxyKernel::State pk;
+    std::vector<unsigned long long> stat;
+    CallGraph::State callgraph;
+    // このチェックポイントの後で書き込まれたページの元の中身
+    std::vector<SavedPage> pages;
+};
+
+class CheckpointList
+{
+    Memory *m;
+    // 古い順。keep 個を超えたら古いものから捨てる
+    std::deque<Checkpoint> list;
+    size_t keep;
+    unsigned long long interval;
+
+  public:
+    // 次にチェックポイントを取る命令数
+    unsigned long long next;
+
+    CheckpointList(Memory *m, unsigned long long interval, size_t keep)
+        : m(m), keep(std::max<size_t>(keep, 1)), interval(std::max(interval, 1ull)), next(0)
+    {
+    }
+    ~CheckpointList()
+    {
+        m->saved_pages = nullptr;
+    }
+
+    size_t size()
+    {
+        return list.size();
+    }
+    Checkpoint &at(size_t k)
+    {
+        return list[k];
+    }
+
+    // 新しいチェックポイントを作る (メモリ以外の中身は呼び出し側が埋める)
+    Checkpoint &take(unsigned long long inst_count)
+    {
+        if (list.empty())
+        {
+            m->snapshot_all_pages();
+        }
+        else
+        {
+            // 前の区間で書き込まれたページだけ印を付け直せばよい
+            for (const SavedPage &s : list.back().pages)
+            {
+                m->snapshot_page(s.page);
+            }
+        }
+        if (list.size() == keep)
+        {
+            list.pop_front();
+        }
+        list.emplace_back();
+        Checkpoint &c = list.back();
+        c.inst_count = inst_count;
+        m->saved_pages = &c.pages;
+        next = inst_count + interval;
+        return c;
+    }
+
+    // inst_count 以前で一番新しいもの。なければ -1
+    int find(unsigned long long inst_count)
+    {
+        for (int k = list.size() - 1; k >= 0; k--)
+        {
+            if (list[k].inst_count <= inst_count)
+            {
+                return k;
+            }
+        }
+        return -1;
+    }
+
+    // k 番目の時点のメモリに戻し、それより新しいものは捨てる
+    Checkpoint &restore(size_t k)
+    {
+        for (size_t j = list.size(); j-- > k;)
+        {
+            for (const SavedPage &s : list[j].pages)
+            {
+                m->restore_page(s);
+                m->snapshot_page(s.page);
+            }
+        }
+        list.erase(list.begin() + k + 1, list.end());
+        Checkpoint &c = list[k];
+        c.pages.clear();
+        m->saved_pages = &c.pages;
+        next = c.inst_count + interval;
+        return c;
+    }
+};
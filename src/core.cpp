@@ -103,6 +103,59 @@ class Core
     MTIMER *mtimer;
     Stat *stat;
     Disasm *disasm;
+    Profiler *profiler;
+    CallGraph *callgraph;
+    TraceWriter *tracer;
+    Cosim *cosim;
+    CacheSim *cache;
+    BranchPredictors *bpred;
+    Pipeline *pipeline;
+    HostPerf *hostperf;
+    TimingConfig *timing;
+    DecodeCache *decode_cache;
+    SymbolTable *symbols;
+    ProxyKernel *pk;
+    // --record / --replay の入力ログ
+    InputLog *input_log;
+    // 読み込んだプログラムの終わり
+    uint32_t image_end;
+    // フェッチで例外が起きた命令 (フェッチの時間だけ進める)
+    DecodedInst fetch_fault;
+    // 命令毎に観測するものがなければ、よく出る2命令の組を1回で実行する
+    bool fusion;
+    // 同じく、ホットなループはスーパーブロックにして実行する
+    SuperblockCache *superblocks;
+    // 翻訳キャッシュのファイルに書く実行ファイルのハッシュ
+    uint64_t build_id;
+    // ブレークポイント (settings->break_point でなければ nullptr)。ウォッチポイントは Memory が持つ
+    Breakpoints *breakpoints;
+    // 逆実行のためのチェックポイント (--checkpoint がなければ nullptr)
+    CheckpointList *checkpoints;
+    // main_loop の先頭でこの命令数に達したら at_event を呼ぶ
+    unsigned long long event_at;
+    // チェックポイントから reexec_target まで実行し直している間は true
+    bool reexec;
+    unsigned long long reexec_target;
+    // 実行し直している間に最後にブレークポイントで止まる所の命令数 (0 ならなし)
+    unsigned long long last_hit;
+    // これまでに進んだ一番先の命令数 (実行し直すときはここまで出力しない)
+    unsigned long long high_water;
+    // 1命令ずつ止まれるように融合とスーパーブロックを使わない
+    bool precise;
+    // --gdb の RSP サーバ (なければ nullptr)。実行中は gdb_poll_at 命令毎に接続と Ctrl-C を確かめる
+    GdbStub *gdb;
+    unsigned long long gdb_poll_at;
+    // gdb が外れたら戻す値
+    bool fusion_allowed;
+    // gdb に送る止まった理由 (ウォッチポイントなら "watch:ADDR;" など)
+    int gdb_signal;
+    std::string gdb_watch;
+    // gdb がつながっている間は、ブレークポイントの命令を実行する前に止まる
+    // 止まった所から再開した最初の命令 (gdb_resume_count 命令目) では止まらない
+    bool break_before;
+    unsigned long long gdb_resume_count;
+    // 次に hostperf の途中経過を確かめる命令数
+    unsigned long long hostperf_next;
     Mode cpu_mode;
     unsigned int long long inst_count;
 
@@ -120,8 +173,7 @@ class Core
     void lui(Decoder *d)
     {
         uint32_t imm = d->u_type_imm();
-        r->set_ireg(d->rd(), imm);
-        (stat->lui.stat)++;
+        r->set_ireg(d->rd_slot, imm);
         disasm->type = "u";
         disasm->inst_name = "lui";
         disasm->dest = d->rd();
@@ -132,8 +184,7 @@ class Core
         // sign extended
         int32_t imm = d->u_type_imm();
         imm += (int32_t)(r->ip);
-        r->set_ireg(d->rd(), imm);
-        (stat->auipc.stat)++;
+        r->set_ireg(d->rd_slot, imm);
         disasm->type = "u";
         disasm->inst_name = "auipc";
         disasm->dest = d->rd();
@@ -143,9 +194,17 @@ class Core
     void jal(Decoder *d)
     {
         int32_t imm = d->jal_imm();
-        r->set_ireg(d->rd(), r->ip + 4);
+        uint32_t ret = r->ip + 4;
+        r->set_ireg(d->rd_slot, ret);
         r->ip = (int32_t)r->ip + imm;
-        (stat->jal.stat)++;
+        if (callgraph && d->rd() == 1)
+        {
+            callgraph->call(r->ip, ret);
+        }
+        if (bpred && d->rd() == 1)
+        {
+            bpred->call(ret);
+        }
         disasm->type = "j";
         disasm->inst_name = "jal";
         disasm->dest = d->rd();
@@ -156,9 +215,31 @@ class Core
         // sign extended
         int32_t imm = d->i_type_imm();
         int32_t s = r->get_ireg(d->rs1());
-        r->set_ireg(d->rd(), r->ip + 4);
+        uint32_t ret = r->ip + 4;
+        r->set_ireg(d->rd_slot, ret);
         r->ip = s + imm;
-        (stat->jalr.stat)++;
+        if (callgraph)
+        {
+            if (d->rd() == 1)
+            {
+                callgraph->call(r->ip, ret);
+            }
+            else if (d->rd() == 0 && d->rs1() == 1)
+            {
+                callgraph->ret(r->ip);
+            }
+        }
+        if (bpred)
+        {
+            if (d->rd() == 1)
+            {
+                bpred->call(ret);
+            }
+            else if (d->rd() == 0 && d->rs1() == 1)
+            {
+                bpred->ret(r->ip);
+            }
+        }
         disasm->type = "i";
         disasm->inst_name = "jalr";
         disasm->dest = d->rd();
@@ -168,6 +249,10 @@ class Core
 
     void branch_inner(Decoder *d, int flag)
     {
+        if (bpred)
+        {
+            bpred->branch(r->ip, r->ip + d->b_type_imm(), flag);
+        }
         if (flag)
         {
             r->ip = (int32_t)r->ip + d->b_type_imm();
@@ -180,7 +265,6 @@ class Core
     void beq(Decoder *d)
     {
         branch_inner(d, r->get_ireg(d->rs1()) == r->get_ireg(d->rs2()));
-        (stat->beq.stat)++;
         disasm->type = "b";
         disasm->inst_name = "beq";
         disasm->src1 = d->rs1();
@@ -190,7 +274,6 @@ class Core
     void bne(Decoder *d)
     {
         branch_inner(d, r->get_ireg(d->rs1()) != r->get_ireg(d->rs2()));
-        (stat->bne.stat)++;
         disasm->type = "b";
         disasm->inst_name = "bne";
         disasm->src1 = d->rs1();
@@ -200,7 +283,6 @@ class Core
     void blt(Decoder *d)
     {
         branch_inner(d, (int32_t)r->get_ireg(d->rs1()) < (int32_t)r->get_ireg(d->rs2()));
-        (stat->blt.stat)++;
         disasm->type = "b";
         disasm->inst_name = "blt";
         disasm->src1 = (int32_t)d->rs1();
@@ -210,7 +292,6 @@ class Core
     void bge(Decoder *d)
     {
         branch_inner(d, (int64_t)r->get_ireg(d->rs1()) >= (int64_t)r->get_ireg(d->rs2()));
-        (stat->bge.stat)++;
         disasm->type = "b";
         disasm->inst_name = "bge";
         disasm->src1 = (int64_t)d->rs1();
@@ -220,7 +301,6 @@ class Core
     void bltu(Decoder *d)
     {
         branch_inner(d, r->get_ireg(d->rs1()) < r->get_ireg(d->rs2()));
-        (stat->bltu.stat)++;
         disasm->type = "b";
         disasm->inst_name = "bltu";
         disasm->src1 = d->rs1();
@@ -230,7 +310,6 @@ class Core
     void bgeu(Decoder *d)
     {
         branch_inner(d, r->get_ireg(d->rs1()) >= r->get_ireg(d->rs2()));
-        (stat->bgeu.stat)++;
         disasm->type = "b";
         disasm->inst_name = "bgeu";
         disasm->src1 = d->rs1();
@@ -249,8 +328,7 @@ class Core
         int32_t val = m->read_mem_1(addr, perm);
         val <<= 24;
         val >>= 24;
-        r->set_ireg(d->rd(), val);
-        (stat->lb.stat)++;
+        r->set_ireg(d->rd_slot, val);
         disasm->type = "i";
         disasm->inst_name = "lb";
         disasm->dest = d->rd();
@@ -268,8 +346,7 @@ class Core
         int32_t val = m->read_mem_2(addr, perm);
         val <<= 16;
         val >>= 16;
-        r->set_ireg(d->rd(), val);
-        (stat->lh.stat)++;
+        r->set_ireg(d->rd_slot, val);
         disasm->type = "i";
         disasm->inst_name = "lh";
         disasm->dest = d->rd();
@@ -285,8 +362,7 @@ class Core
         offset >>= 20;
         uint32_t addr = base + offset;
         uint32_t val = m->read_mem_4(addr, perm);
-        r->set_ireg(d->rd(), val);
-        (stat->lw.stat)++;
+        r->set_ireg(d->rd_slot, val);
         disasm->type = "i";
         disasm->inst_name = "lw";
         disasm->dest = d->rd();
@@ -300,8 +376,7 @@ class Core
         uint32_t offset = d->i_type_imm();
         uint32_t addr = base + offset;
         uint32_t val = m->read_mem_1(addr, perm);
-        r->set_ireg(d->rd(), val);
-        (stat->lbu.stat)++;
+        r->set_ireg(d->rd_slot, val);
         disasm->type = "i";
         disasm->inst_name = "lbu";
         disasm->dest = d->rd();
@@ -315,8 +390,7 @@ class Core
         uint32_t offset = d->i_type_imm();
         uint32_t addr = base + offset;
         uint32_t val = m->read_mem_2(addr, perm);
-        r->set_ireg(d->rd(), val);
-        (stat->lhu.stat)++;
+        r->set_ireg(d->rd_slot, val);
         disasm->type = "i";
         disasm->inst_name = "lhu";
         disasm->dest = d->rd();
@@ -334,7 +408,6 @@ class Core
         offset >>= 20;
         uint32_t addr = base + offset;
         m->write_mem(addr, src, perm);
-        (stat->sb.stat)++;
         disasm->type = "s";
         disasm->inst_name = "sb";
         disasm->src = d->rs2();
@@ -352,7 +425,6 @@ class Core
         offset >>= 20;
         uint32_t addr = base + offset;
         m->write_mem(addr, src, perm);
-        (stat->sh.stat)++;
         disasm->type = "s";
         disasm->inst_name = "sh";
         disasm->src = d->rs2();
@@ -370,7 +442,6 @@ class Core
         offset >>= 20;
         uint32_t addr = base + offset;
         m->write_mem(addr, src, perm);
-        (stat->sw.stat)++;
         disasm->type = "s";
         disasm->inst_name = "sw";
         disasm->src = d->rs2();
@@ -382,8 +453,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm();
-        r->set_ireg(d->rd(), ALU::add(x, y));
-        (stat->addi.stat)++;
+        r->set_ireg(d->rd_slot, ALU::add(x, y));
         disasm->type = "i";
         disasm->inst_name = "addi";
         disasm->dest = d->rd();
@@ -394,8 +464,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm();
-        r->set_ireg(d->rd(), ALU::slt(x, y));
-        (stat->slti.stat)++;
+        r->set_ireg(d->rd_slot, ALU::slt(x, y));
         disasm->type = "i";
         disasm->inst_name = "slti";
         disasm->dest = d->rd();
@@ -406,8 +475,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm();
-        r->set_ireg(d->rd(), ALU::sltu(x, y));
-        (stat->sltiu.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sltu(x, y));
         disasm->type = "i";
         disasm->inst_name = "sltiu";
         disasm->dest = d->rd();
@@ -418,8 +486,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm();
-        r->set_ireg(d->rd(), ALU::xor_(x, y));
-        (stat->xori.stat)++;
+        r->set_ireg(d->rd_slot, ALU::xor_(x, y));
         disasm->type = "i";
         disasm->inst_name = "xori";
         disasm->dest = d->rd();
@@ -431,8 +498,7 @@ class Core
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm();
         y &= 0b111111111111;
-        r->set_ireg(d->rd(), ALU::or_(x, y));
-        (stat->ori.stat)++;
+        r->set_ireg(d->rd_slot, ALU::or_(x, y));
         disasm->type = "i";
         disasm->inst_name = "ori";
         disasm->dest = d->rd();
@@ -443,8 +509,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm();
-        r->set_ireg(d->rd(), ALU::and_(x, y));
-        (stat->andi.stat)++;
+        r->set_ireg(d->rd_slot, ALU::and_(x, y));
         disasm->type = "i";
         disasm->inst_name = "andi";
         disasm->dest = d->rd();
@@ -455,8 +520,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm() & 0x1f;
-        r->set_ireg(d->rd(), ALU::sll(x, y));
-        (stat->slli.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sll(x, y));
         disasm->type = "i";
         disasm->inst_name = "slli";
         disasm->dest = d->rd();
@@ -467,8 +531,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm() & 0x1f;
-        r->set_ireg(d->rd(), ALU::srl(x, y));
-        (stat->srli.stat)++;
+        r->set_ireg(d->rd_slot, ALU::srl(x, y));
         disasm->type = "i";
         disasm->inst_name = "srli";
         disasm->dest = d->rd();
@@ -479,8 +542,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = d->i_type_imm() & 0x1f;
-        r->set_ireg(d->rd(), ALU::sra(x, y));
-        //(stat->srai.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sra(x, y));
         disasm->type = "i";
         disasm->inst_name = "srai";
         disasm->dest = d->rd();
@@ -507,8 +569,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::add(x, y));
-        (stat->add.stat)++;
+        r->set_ireg(d->rd_slot, ALU::add(x, y));
         disasm->type = "r";
         disasm->inst_name = "add";
         disasm->dest = d->rd();
@@ -519,8 +580,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::sub(x, y));
-        (stat->sub.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sub(x, y));
         disasm->type = "r";
         disasm->inst_name = "sub";
         disasm->dest = d->rd();
@@ -531,8 +591,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::sll(x, y));
-        (stat->sll.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sll(x, y));
         disasm->type = "r";
         disasm->inst_name = "sll";
         disasm->dest = d->rd();
@@ -543,8 +602,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::slt(x, y));
-        (stat->slt.stat)++;
+        r->set_ireg(d->rd_slot, ALU::slt(x, y));
         disasm->type = "r";
         disasm->inst_name = "slt";
         disasm->dest = d->rd();
@@ -555,8 +613,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::sltu(x, y));
-        (stat->sltu.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sltu(x, y));
         disasm->type = "r";
         disasm->inst_name = "sltu";
         disasm->dest = d->rd();
@@ -567,8 +624,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::xor_(x, y));
-        (stat->xor_.stat)++;
+        r->set_ireg(d->rd_slot, ALU::xor_(x, y));
         disasm->type = "r";
         disasm->inst_name = "xor";
         disasm->dest = d->rd();
@@ -579,8 +635,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::srl(x, y));
-        (stat->srl.stat)++;
+        r->set_ireg(d->rd_slot, ALU::srl(x, y));
         disasm->type = "r";
         disasm->inst_name = "srl";
         disasm->dest = d->rd();
@@ -591,8 +646,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::sra(x, y));
-        (stat->sra.stat)++;
+        r->set_ireg(d->rd_slot, ALU::sra(x, y));
         disasm->type = "r";
         disasm->inst_name = "sra";
         disasm->dest = d->rd();
@@ -603,8 +657,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::or_(x, y));
-        (stat->or_.stat)++;
+        r->set_ireg(d->rd_slot, ALU::or_(x, y));
         disasm->type = "r";
         disasm->inst_name = "or";
         disasm->dest = d->rd();
@@ -615,8 +668,7 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::and_(x, y));
-        (stat->and_.stat)++;
+        r->set_ireg(d->rd_slot, ALU::and_(x, y));
         disasm->type = "r";
         disasm->inst_name = "and";
         disasm->dest = d->rd();
@@ -628,56 +680,56 @@ class Core
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::mul(x, y));
+        r->set_ireg(d->rd_slot, ALU::mul(x, y));
     }
 
     void mulh(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::mulh(x, y));
+        r->set_ireg(d->rd_slot, ALU::mulh(x, y));
     }
 
     void mulhu(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::mulhu(x, y));
+        r->set_ireg(d->rd_slot, ALU::mulhu(x, y));
     }
 
     void mulhsu(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::mulhsu(x, y));
+        r->set_ireg(d->rd_slot, ALU::mulhsu(x, y));
     }
 
     void div(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::div(x, y));
+        r->set_ireg(d->rd_slot, ALU::div(x, y));
     }
 
     void rem(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::rem(x, y));
+        r->set_ireg(d->rd_slot, ALU::rem(x, y));
     }
 
     void divu(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::divu(x, y));
+        r->set_ireg(d->rd_slot, ALU::divu(x, y));
     }
 
     void remu(Decoder *d)
     {
         uint32_t x = r->get_ireg(d->rs1());
         uint32_t y = r->get_ireg(d->rs2());
-        r->set_ireg(d->rd(), ALU::remu(x, y));
+        r->set_ireg(d->rd_slot, ALU::remu(x, y));
     }
 
     void branch(Decoder *d)
@@ -951,7 +1003,6 @@ class Core
         uint32_t addr = base + offset;
         uint32_t val = m->read_mem_4(addr, perm);
         r->set_freg_raw(d->rd(), val);
-        (stat->flw.stat)++;
         disasm->type = "fi";
         disasm->inst_name = "flw";
         disasm->dest = d->rd();
@@ -969,7 +1020,6 @@ class Core
         offset >>= 20;
         uint32_t addr = base + offset;
         m->write_mem(addr, src, perm);
-        (stat->fsw.stat)++;
         disasm->type = "fs";
         disasm->inst_name = "fsw";
         disasm->src = d->rs2();
@@ -986,7 +1036,6 @@ class Core
         uint32_t x = r->get_freg_raw(d->rs1());
         uint32_t y = r->get_freg_raw(d->rs2());
         r->set_freg_raw(d->rd(), FPU::fadd(x, y));
-        (stat->fadd.stat)++;
         disasm->type = "fr";
         disasm->inst_name = "fadd";
         disasm->dest = d->rd();
@@ -1002,7 +1051,6 @@ class Core
         uint32_t x = r->get_freg_raw(d->rs1());
         uint32_t y = r->get_freg_raw(d->rs2());
         r->set_freg_raw(d->rd(), FPU::fsub(x, y));
-        (stat->fsub.stat)++;
         disasm->type = "fr";
         disasm->inst_name = "fsub";
         disasm->dest = d->rd();
@@ -1018,7 +1066,6 @@ class Core
         uint32_t x = r->get_freg_raw(d->rs1());
         uint32_t y = r->get_freg_raw(d->rs2());
         r->set_freg_raw(d->rd(), FPU::fmul(x, y));
-        (stat->fmul.stat)++;
         disasm->type = "fr";
         disasm->inst_name = "fmul";
         disasm->dest = d->rd();
@@ -1034,7 +1081,6 @@ class Core
         uint32_t x = r->get_freg_raw(d->rs1());
         uint32_t y = r->get_freg_raw(d->rs2());
         r->set_freg_raw(d->rd(), FPU::fdiv(x, y));
-        (stat->fdiv.stat)++;
         disasm->type = "fr";
         disasm->inst_name = "fdiv";
         disasm->dest = d->rd();
@@ -1053,19 +1099,102 @@ class Core
         }
         uint32_t x = r->get_freg_raw(d->rs1());
         r->set_freg_raw(d->rd(), FPU::fsqrt(x));
-        (stat->fsqrt.stat)++;
         disasm->type = "fR";
         disasm->inst_name = "fsqrt";
         disasm->dest = d->rd();
         disasm->src1 = d->rs1();
     }
 
+    void fmadd(Decoder *d)
+    {
+        if (d->rm() != 0)
+        {
+            error_dump("丸め型がおかしいです\n");
+        }
+        if (d->fmt() != 0)
+        {
+            error_dump("対応していないfmtです(fmadd): %x\n", d->fmt());
+        }
+        uint32_t x = r->get_freg_raw(d->rs1());
+        uint32_t y = r->get_freg_raw(d->rs2());
+        uint32_t z = r->get_freg_raw(d->rs3());
+        r->set_freg_raw(d->rd(), FPU::fmadd(x, y, z));
+        disasm->type = "fr4";
+        disasm->inst_name = "fmadd";
+        disasm->dest = d->rd();
+        disasm->src1 = d->rs1();
+        disasm->src2 = d->rs2();
+        disasm->src3 = d->rs3();
+    }
+    void fmsub(Decoder *d)
+    {
+        if (d->rm() != 0)
+        {
+            error_dump("丸め型がおかしいです\n");
+        }
+        if (d->fmt() != 0)
+        {
+            error_dump("対応していないfmtです(fmsub): %x\n", d->fmt());
+        }
+        uint32_t x = r->get_freg_raw(d->rs1());
+        uint32_t y = r->get_freg_raw(d->rs2());
+        uint32_t z = r->get_freg_raw(d->rs3());
+        r->set_freg_raw(d->rd(), FPU::fmsub(x, y, z));
+        disasm->type = "fr4";
+        disasm->inst_name = "fmsub";
+        disasm->dest = d->rd();
+        disasm->src1 = d->rs1();
+        disasm->src2 = d->rs2();
+        disasm->src3 = d->rs3();
+    }
+    void fnmsub(Decoder *d)
+    {
+        if (d->rm() != 0)
+        {
+            error_dump("丸め型がおかしいです\n");
+        }
+        if (d->fmt() != 0)
+        {
+            error_dump("対応していないfmtです(fnmsub): %x\n", d->fmt());
+        }
+        uint32_t x = r->get_freg_raw(d->rs1());
+        uint32_t y = r->get_freg_raw(d->rs2());
+        uint32_t z = r->get_freg_raw(d->rs3());
+        r->set_freg_raw(d->rd(), FPU::fnmsub(x, y, z));
+        disasm->type = "fr4";
+        disasm->inst_name = "fnmsub";
+        disasm->dest = d->rd();
+        disasm->src1 = d->rs1();
+        disasm->src2 = d->rs2();
+        disasm->src3 = d->rs3();
+    }
+    void fnmadd(Decoder *d)
+    {
+        if (d->rm() != 0)
+        {
+            error_dump("丸め型がおかしいです\n");
+        }
+        if (d->fmt() != 0)
+        {
+            error_dump("対応していないfmtです(fnmadd): %x\n", d->fmt());
+        }
+        uint32_t x = r->get_freg_raw(d->rs1());
+        uint32_t y = r->get_freg_raw(d->rs2());
+        uint32_t z = r->get_freg_raw(d->rs3());
+        r->set_freg_raw(d->rd(), FPU::fnmadd(x, y, z));
+        disasm->type = "fr4";
+        disasm->inst_name = "fnmadd";
+        disasm->dest = d->rd();
+        disasm->src1 = d->rs1();
+        disasm->src2 = d->rs2();
+        disasm->src3 = d->rs3();
+    }
+
     void _fsgnj(Decoder *d)
     {
         float x = r->get_freg(d->rs1());
         float y = r->get_freg(d->rs2());
         r->set_freg(d->rd(), x * y > 0 ? x : -x);
-        (stat->fsgnj.stat)++;
         disasm->type = "fr";
         disasm->inst_name = "fsgnj";
         disasm->dest = d->rd();
@@ -1077,7 +1206,6 @@ class Core
         float x = r->get_freg(d->rs1());
         float y = r->get_freg(d->rs2());
         r->set_freg(d->rd(), x * y > 0 ? -x : x);
-        (stat->fsgnjn.stat)++;
         disasm->type = "fr";
         disasm->inst_name = "fsgnjn";
         disasm->dest = d->rd();
@@ -1096,8 +1224,7 @@ class Core
             error_dump("命令フォーマットがおかしいです(fcvt_w_sではrs2()は0になる)\n");
         }
         float x = r->get_freg(d->rs1());
-        r->set_ireg(d->rd(), FPU::float2int(x));
-        (stat->fcvt_w_s.stat)++;
+        r->set_ireg(d->rd_slot, FPU::float2int(x));
         disasm->type = "fR";
         disasm->inst_name = "fcvt_w_s";
         disasm->dest = d->rd();
@@ -1115,7 +1242,6 @@ class Core
         }
         uint32_t x = r->get_ireg(d->rs1());
         r->set_freg(d->rd(), FPU::int2float(x));
-        (stat->fcvt_s_w.stat)++;
         disasm->type = "fR";
         disasm->inst_name = "fcvt_s_w";
         disasm->dest = d->rd();
@@ -1126,8 +1252,7 @@ class Core
     {
         float x = r->get_freg(d->rs1());
         float y = r->get_freg(d->rs2());
-        r->set_ireg(d->rd(), FPU::feq(x, y));
-        (stat->feq.stat)++;
+        r->set_ireg(d->rd_slot, FPU::feq(x, y));
         disasm->type = "fr";
         disasm->inst_name = "feq";
         disasm->dest = d->rd();
@@ -1138,8 +1263,7 @@ class Core
     {
         float x = r->get_freg(d->rs1());
         float y = r->get_freg(d->rs2());
-        r->set_ireg(d->rd(), FPU::flt(x, y));
-        (stat->flt.stat)++;
+        r->set_ireg(d->rd_slot, FPU::flt(x, y));
         disasm->type = "fr";
         disasm->inst_name = "flt";
         disasm->dest = d->rd();
@@ -1150,8 +1274,7 @@ class Core
     {
         float x = r->get_freg(d->rs1());
         float y = r->get_freg(d->rs2());
-        r->set_ireg(d->rd(), FPU::fle(x, y));
-        (stat->fle.stat)++;
+        r->set_ireg(d->rd_slot, FPU::fle(x, y));
         disasm->type = "fr";
         disasm->inst_name = "fle";
         disasm->dest = d->rd();
@@ -1297,175 +1420,131 @@ class Core
     uint32_t sie;
     uint32_t sip;
 
-    void check_supervisor()
+    // 割り込みが入る状態か (sstatus, sie, sip を書き換えたら update_intr で求め直す)
+    bool intr_pending;
+    void update_intr()
     {
-        if (cpu_mode == Mode::User)
-        {
-            error_dump("check supervisor\n");
-        }
+        intr_pending = ((sstatus >> 1) & 1) && (((sie & sip) >> 5) & 1);
     }
 
-    void csrrw(Decoder *d)
+    // CSR の表。CSR 番号 (12bit) から csr_file の添字を csr_index で引く
+    struct CsrEntry
     {
-        check_supervisor();
-        uint32_t x = r->get_ireg(d->rs1());
-        uint32_t csr;
-        switch (static_cast<CSR>(d->i_type_imm()))
-        {
-        case CSR::SATP:
-            csr = m->read_satp();
-            m->write_satp(x);
-            break;
-        case CSR::SEPC:
-            csr = sepc;
-            sepc = x;
-            break;
-        case CSR::SSCRATCH:
-            csr = sscratch;
-            sscratch = x;
-            break;
-        case CSR::STVEC:
-            csr = stvec;
-            stvec = x;
-            break;
-        case CSR::SCAUSE:
-            csr = scause;
-            scause = x;
-            break;
-        case CSR::SSTATUS:
-            csr = sstatus;
-            sstatus = x;
-            break;
-        case CSR::SIE:
-            csr = sie;
-            sie = x;
-            break;
-        case CSR::STVAL:
-            csr = stval;
-            stval = x;
-            break;
-        case CSR::SIP:
-            csr = sip;
-            stval = x;
-            break;
-        default:
-            error_dump("対応していないstatusレジスタ番号です");
-        }
-        r->set_ireg(d->rd(), csr);
-    }
+        uint32_t Core::*reg;              // 値を持つメンバ (nullptr なら read で読む)
+        uint32_t (Core::*read)();         //
+        void (Core::*on_write)(uint32_t); // 書き込んだ後の副作用
+        uint32_t wmask;                   // 書き込めるビット (0 なら読み取り専用)
+    };
+    std::vector<uint8_t> csr_index;
+    std::vector<CsrEntry> csr_file;
 
-    void csrrs(Decoder *d)
+    void add_csr(CSR num, uint32_t Core::*reg, uint32_t (Core::*read)(), void (Core::*on_write)(uint32_t), uint32_t wmask)
     {
-        check_supervisor();
-        uint32_t x = r->get_ireg(d->rs1());
-        uint32_t csr;
-        switch (static_cast<CSR>(d->i_type_imm()))
-        {
-        case CSR::SATP:
-            csr = m->read_satp();
-            m->write_satp(x | csr);
-            break;
-        case CSR::SEPC:
-            csr = sepc;
-            sepc = x | csr;
-            break;
-        case CSR::SSCRATCH:
-            csr = sscratch;
-            sscratch = x | csr;
-            break;
-        case CSR::STVEC:
-            csr = stvec;
-            stvec = x | csr;
-            break;
-        case CSR::SCAUSE:
-            csr = scause;
-            scause = x | csr;
-            break;
-        case CSR::SSTATUS:
-            csr = sstatus;
-            sstatus = x | csr;
-            break;
-        case CSR::SIE:
-            csr = sie;
-            sie = x | csr;
-            break;
-        case CSR::STVAL:
-            csr = stval;
-            stval = x | csr;
-            break;
-        case CSR::SIP:
-            csr = sip;
-            sip = x | csr;
-            break;
-        default:
-            error_dump("対応していないstatusレジスタ番号です");
-        }
-        r->set_ireg(d->rd(), csr);
+        csr_index[static_cast<uint16_t>(num)] = csr_file.size();
+        csr_file.push_back({reg, read, on_write, wmask});
     }
 
-    void csrrc(Decoder *d)
+    void init_csr_file()
     {
-        check_supervisor();
-        uint32_t x = r->get_ireg(d->rs1());
-
-        uint32_t csr;
-        switch (static_cast<CSR>(d->i_type_imm()))
-        {
-        case CSR::SATP:
-            csr = m->read_satp();
-            m->write_satp((~x) & csr);
-            break;
-        case CSR::SEPC:
-            csr = sepc;
-            sepc = ~x & csr;
-            break;
-        case CSR::SSCRATCH:
-            csr = sscratch;
-            sscratch = ~x & csr;
-            break;
-        case CSR::STVEC:
-            csr = stvec;
-            stvec = ~x & csr;
-            break;
-        case CSR::SCAUSE:
-            csr = scause;
-            scause = ~x & csr;
-            break;
-        case CSR::SSTATUS:
-            csr = sstatus;
-            sstatus = ~x & csr;
-            break;
-        case CSR::SIE:
-            csr = sie;
-            sie = ~x & csr;
-            break;
-        case CSR::STVAL:
-            csr = stval;
-            stval = ~x & csr;
-            break;
-        case CSR::SIP:
-            csr = sip;
-            sip = ~x & csr;
-            break;
-        default:
-            error_dump("対応していないstatusレジスタ番号です: %x", d->i_type_imm());
-        }
-        r->set_ireg(d->rd(), csr);
+        csr_index.assign(1 << 12, 0);
+        csr_file.assign(1, CsrEntry{}); // 0 は未対応
+        add_csr(CSR::SSTATUS, &Core::sstatus, nullptr, &Core::csr_update_intr, 0x000c0122);
+        add_csr(CSR::SIE, &Core::sie, nullptr, &Core::csr_update_intr, 0x222);
+        add_csr(CSR::STVEC, &Core::stvec, nullptr, nullptr, 0xffffffff);
+        add_csr(CSR::SSCRATCH, &Core::sscratch, nullptr, nullptr, 0xffffffff);
+        add_csr(CSR::SEPC, &Core::sepc, nullptr, nullptr, 0xffffffff);
+        add_csr(CSR::SCAUSE, &Core::scause, nullptr, nullptr, 0xffffffff);
+        add_csr(CSR::STVAL, &Core::stval, nullptr, nullptr, 0xffffffff);
+        add_csr(CSR::SIP, &Core::sip, nullptr, &Core::csr_update_intr, 0x222);
+        add_csr(CSR::SATP, nullptr, &Core::csr_read_satp, &Core::csr_write_satp, 0xffffffff);
+        add_csr(CSR::CYCLE, nullptr, &Core::csr_read_time, nullptr, 0);
+        add_csr(CSR::TIME, nullptr, &Core::csr_read_time, nullptr, 0);
+        add_csr(CSR::INSTRET, nullptr, &Core::csr_read_instret, nullptr, 0);
+        add_csr(CSR::CYCLEH, nullptr, &Core::csr_read_timeh, nullptr, 0);
+        add_csr(CSR::TIMEH, nullptr, &Core::csr_read_timeh, nullptr, 0);
+        add_csr(CSR::INSTRETH, nullptr, &Core::csr_read_instreth, nullptr, 0);
     }
 
-    void csrrwi(Decoder *d)
+    void csr_update_intr(uint32_t)
     {
-        // not implemented
+        update_intr();
     }
-
-    void csrrsi(Decoder *d)
+    uint32_t csr_read_satp()
+    {
+        return m->read_satp();
+    }
+    void csr_write_satp(uint32_t val)
+    {
+        // アドレス変換を覚えておくもの (TLB) はないので、切り替えるだけでよい
+        // スーパーブロックは入るときに物理アドレスを確かめている
+        m->write_satp(val);
+    }
+    // cycle は仮想時間で数える
+    uint32_t csr_read_time()
     {
-        // not implemented
+        return mtimer->read_mtimel();
+    }
+    uint32_t csr_read_timeh()
+    {
+        return mtimer->read_mtimeh();
+    }
+    uint32_t csr_read_instret()
+    {
+        return (uint32_t)inst_count;
+    }
+    uint32_t csr_read_instreth()
+    {
+        return (uint32_t)(inst_count >> 32);
     }
 
-    void csrrci(Decoder *d)
+    // csrrw, csrrs, csrrc と即値版
+    void csr(Decoder *d)
     {
-        // not implemented
+        uint16_t num = d->csr();
+        if (csr_index[num] == 0)
+        {
+            error_dump("対応していないstatusレジスタ番号です: %x\n", num);
+        }
+        const CsrEntry &e = csr_file[csr_index[num]];
+        // 番号の [9:8] が必要な特権レベル
+        if (cpu_mode == Mode::User && ((num >> 8) & 3) != 0)
+        {
+            error_dump("check supervisor\n");
+        }
+        uint8_t funct3 = d->funct3();
+        uint32_t x = (funct3 & 0b100) ? d->rs1() : r->get_ireg(d->rs1());
+        uint32_t old = e.reg ? this->*e.reg : (this->*e.read)();
+        uint32_t val;
+        switch (funct3 & 0b11)
+        {
+        case 0b01: // csrrw
+            val = x;
+            break;
+        case 0b10: // csrrs
+            val = old | x;
+            break;
+        default: // csrrc
+            val = old & ~x;
+            break;
+        }
+        // csrrs/csrrc は rs1 (即値) が 0 なら書き込まない
+        if ((funct3 & 0b11) == 0b01 || d->rs1() != 0)
+        {
+            if (e.wmask == 0)
+            {
+                error_dump("読み取り専用のCSRに書き込もうとしました: %x\n", num);
+            }
+            val = (old & ~e.wmask) | (val & e.wmask);
+            if (e.reg)
+            {
+                this->*e.reg = val;
+            }
+            if (e.on_write)
+            {
+                (this->*e.on_write)(val);
+            }
+        }
+        r->set_ireg(d->rd_slot, old);
     }
 
     bool sret_flag;
@@ -1477,6 +1556,7 @@ class Core
         {
             uint32_t sstatus5 = (sstatus >> 5) & 1;
             sstatus = (1 << 5) | (sstatus5 << 1);
+            update_intr();
         }
         else
         {
@@ -1486,6 +1566,10 @@ class Core
         cpu_mode = sstatus8 == 1 ? Mode::Supervisor : Mode::User;
         r->ip = sepc;
         sret_flag = true;
+        if (callgraph)
+        {
+            callgraph->trap_exit();
+        }
     }
 
     uint32_t scause;
@@ -1495,6 +1579,11 @@ class Core
 
     void ecall(Decoder *d)
     {
+        if (pk && cpu_mode == User)
+        {
+            pk->syscall(r, m, mtimer, mode_perm());
+            return;
+        }
         r->ip -= 4;
         if (cpu_mode == User)
         {
@@ -1529,22 +1618,12 @@ class Core
         switch (static_cast<System_Inst>(d->funct3()))
         {
         case System_Inst::CSRRW:
-            csrrw(d);
-            break;
         case System_Inst::CSRRS:
-            csrrs(d);
-            break;
         case System_Inst::CSRRC:
-            csrrc(d);
-            break;
         case System_Inst::CSRRWI:
-            csrrwi(d);
-            break;
         case System_Inst::CSRRSI:
-            csrrsi(d);
-            break;
         case System_Inst::CSRRCI:
-            csrrci(d);
+            csr(d);
             break;
         case System_Inst::PRIV:
             priv(d);
@@ -1577,13 +1656,11 @@ class Core
             branch(d);
             break;
         case Inst::LOAD:
-            mtimer->incr_time(40);
             load(d);
             if (!trap)
                 r->ip += 4;
             break;
         case Inst::STORE:
-            mtimer->incr_time(40);
             store(d);
             if (!trap)
                 r->ip += 4;
@@ -1597,13 +1674,11 @@ class Core
             r->ip += 4;
             break;
         case Inst::FLOAD:
-            mtimer->incr_time(40);
             fload(d);
             if (!trap)
                 r->ip += 4;
             break;
         case Inst::FSTORE:
-            mtimer->incr_time(40);
             fstore(d);
             if (!trap)
                 r->ip += 4;
@@ -1612,6 +1687,22 @@ class Core
             fpu(d);
             r->ip += 4;
             break;
+        case Inst::FMADD:
+            fmadd(d);
+            r->ip += 4;
+            break;
+        case Inst::FMSUB:
+            fmsub(d);
+            r->ip += 4;
+            break;
+        case Inst::FNMSUB:
+            fnmsub(d);
+            r->ip += 4;
+            break;
+        case Inst::FNMADD:
+            fnmadd(d);
+            r->ip += 4;
+            break;
         case Inst::SYSTEM:
             sys(d);
             if (sret_flag)
@@ -1631,138 +1722,1490 @@ class Core
         }
     }
 
-  public:
-    Core(std::string filename, Settings *settings)
+    // ip の命令 (di) と次の命令を融合して実行する。融合しなかったら false
+    // 2命令目でトラップしたときは1命令目は完了させ、ip+4 でトラップした状態にする
+    bool run_fused(DecodedInst *di, uint32_t ip, Permission perm)
     {
-        r = new Register;
-        io = new IO;
-        mtimer = new MTIMER();
-        m = new Memory(io, mtimer);
-        stat = new Stat;
-        disasm = new Disasm;
-        cpu_mode = Mode::Supervisor;
-        inst_count = 0;
-        sret_flag = false;
-        csr_unprivileged = false;
-        sscratch = 0;
-        sepc = 0;
-        stvec = 0;
-        scause = 0;
-        stval = 0;
-        sie = 0;
-        sip = 0;
-
-        sstatus = 0;
-
-        trap = false;
-
-        this->settings = settings;
-
-        char buf[512];
-        std::ifstream ifs(filename);
-        uint32_t addr = instruction_load_address;
-        while (!ifs.eof())
+        // 1命令目の後でタイマ割り込みが入るなら分けて実行する
+        if (((sstatus >> 1) & 1) && ((sie >> 5) & 1) && mtimer->is_timer_intr())
         {
-            ifs.read(buf, 512);
-            int read_bytes = ifs.gcount();
-            m->mmap(addr, (uint8_t *)buf, read_bytes);
-            addr += read_bytes;
+            return false;
         }
-    }
-    ~Core()
-    {
-        delete r;
-        delete m;
-        delete mtimer;
-        delete io;
-        delete stat;
-        delete disasm;
-    }
-    void show_stack_from_top()
-    {
-        std::cout << "Stack" << std::endl;
-        m->show_data(r->get_ireg(default_stack_pointer), default_stack_dump_size);
-    }
-    void info()
-    {
-        if (!settings->hide_error_dump)
+        uint32_t ip2 = ip + 4;
+        uint32_t code;
+        try
         {
-            printf("inst_count: %llx\n", inst_count);
-            r->info();
-            show_stack_from_top();
-            io->show_status();
-            stat->show_stats();
+            code = m->get_inst(ip2, perm);
         }
-    }
-    void main_loop()
-    {
-        int mycount = 0;
-        while (1)
+        catch (Exception e)
         {
-            Permission perm = mode_perm().read_on().exec_on();
-            uint32_t ip = r->ip;
-            uint32_t inst;
+            return false;
+        }
+        if (!di->fuse_paired || di->fuse_code != code)
+        {
+            decode_cache->pair(di, code);
+        }
+        if (di->fuse == FUSE_NONE)
+        {
+            return false;
+        }
 
-            // timer intr
-            bool occur_intr = ((sstatus >> 1) & 1) && (((sie & sip) >> 5) & 1);
-            if (occur_intr)
+        // 1命令目はここで完了扱いにする (2命令目は main_loop で数える)
+        Decoder &a = di->d;
+        Decoder b(code);
+        stat->incr(di->id);
+        inst_count++;
+        mtimer->incr_time(di->fuse_cost);
+        switch (di->fuse)
+        {
+        case FUSE_LUI_ADDI:
+            r->set_ireg(b.rd_slot, a.u_type_imm() + b.i_type_imm());
+            r->ip = ip2 + 4;
+            break;
+        case FUSE_AUIPC_JALR:
+        {
+            uint32_t base = ip + a.u_type_imm();
+            r->set_ireg(a.rd_slot, base);
+            r->set_ireg(b.rd_slot, ip2 + 4);
+            r->ip = base + b.i_type_imm();
+            break;
+        }
+        case FUSE_SLT_BRANCH:
+        {
+            uint32_t x = r->get_ireg(a.rs1());
+            uint32_t y = r->get_ireg(a.rs2());
+            uint32_t t = di->id == ID_SLT ? ALU::slt(x, y) : ALU::sltu(x, y);
+            r->set_ireg(a.rd_slot, t);
+            bool taken = di->fuse_id == ID_BNE ? t != 0 : t == 0;
+            r->ip = taken ? ip2 + b.b_type_imm() : ip2 + 4;
+            break;
+        }
+        case FUSE_ADDI_SP_LW:
+        case FUSE_ADDI_SP_SW:
+            r->set_ireg(2, r->get_ireg(2) + a.i_type_imm());
+            r->ip = ip2;
+            if (di->fuse == FUSE_ADDI_SP_LW)
             {
-                uint32_t sstatus1 = (sstatus >> 1) & 1;
-                sstatus = (cpu_mode == Mode::Supervisor ? 1 << 8 : 0) | (sstatus1 << 5);
-                cpu_mode = Mode::Supervisor;
-                // always Direct Mode
-                sepc = r->ip;
-                stval = 0;
-                scause = (1 << 31) | (1 << 5);
-                //printf("intr in %x \n", r->ip);
-                r->ip = stvec >> 2;
-                continue;
+                load(&b);
             }
-            try
+            else
             {
-                mtimer->incr_time(40);
-                inst = m->get_inst(ip, perm);
+                store(&b);
             }
-            catch (Exception e)
+            if (!trap)
             {
-                switch (e.cause)
-                {
-                case Cause::PageFault:
-                    scause = 1 << 12; // INST PGFAULT
-                    break;
-                case Cause::AccessFault:
-                    scause = 1 << 1;
+                r->ip += 4;
+            }
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    // 作った後にコードが書き換えられたり、別の物理ページに変わっていたら捨てる
+    bool superblock_valid(DecodedInst *di, uint32_t ip, Permission perm)
+    {
+        Superblock *sb = di->sb;
+        if (m->translate(ip, perm) == sb->head_pa)
+        {
+            if (sb->gen == m->code_gen)
+            {
+                return true;
+            }
+            // コードを読み直して、変わっていなければそのまま使う
+            if (superblocks->unchanged(sb, perm, m))
+            {
+                sb->gen = m->code_gen;
+                return true;
+            }
+        }
+        superblocks->release(sb);
+        di->sb = nullptr;
+        di->head_count = 0;
+        return false;
+    }
+
+    // スーパーブロックを実行する。1命令目の時間は main_loop で進めてある
+    // 最後に実行した命令を返す (その命令の数え上げは main_loop でする)
+    InstId run_superblock(Superblock *sb)
+    {
+        static const unsigned long long max_iterations = 1 << 16;
+        uint32_t *x = r->iregs();
+        Permission rperm = mode_perm();
+        Permission wperm = mode_perm().write_on();
+        bool intr_on = ((sstatus >> 1) & 1) && ((sie >> 5) & 1);
+        uint64_t gen = m->code_gen;
+        const SbOp *ops = sb->ops.data();
+        const size_t n = sb->ops.size();
+        const SbOp *op = ops;
+        unsigned long long iterations = 0;
+        try
+        {
+            while (1)
+            {
+                uint32_t a = x[op->rs1];
+                uint32_t b = x[op->rs2];
+                bool taken = false;
+                switch (op->id)
+                {
+                case ID_LUI:
+                case ID_AUIPC:
+                case ID_JAL:
+                    x[op->rd] = op->imm;
+                    break;
+                case ID_BEQ:
+                    taken = a == b;
+                    break;
+                case ID_BNE:
+                    taken = a != b;
+                    break;
+                case ID_BLT:
+                    taken = (int32_t)a < (int32_t)b;
+                    break;
+                case ID_BGE:
+                    // インタプリタに合わせる
+                    taken = (int64_t)a >= (int64_t)b;
+                    break;
+                case ID_BLTU:
+                    taken = a < b;
+                    break;
+                case ID_BGEU:
+                    taken = a >= b;
+                    break;
+                case ID_LB:
+                    x[op->rd] = (int32_t)(int8_t)m->read_mem_1(a + op->imm, rperm);
+                    break;
+                case ID_LH:
+                    x[op->rd] = (int32_t)(int16_t)m->read_mem_2(a + op->imm, rperm);
+                    break;
+                case ID_LW:
+                    x[op->rd] = m->read_mem_4(a + op->imm, rperm);
+                    break;
+                case ID_LBU:
+                    x[op->rd] = m->read_mem_1(a + op->imm, rperm);
+                    break;
+                case ID_LHU:
+                    x[op->rd] = m->read_mem_2(a + op->imm, rperm);
+                    break;
+                case ID_SB:
+                    m->write_mem(a + op->imm, (uint8_t)(b & 0xff), wperm);
+                    break;
+                case ID_SH:
+                    m->write_mem(a + op->imm, (uint16_t)(b & 0xffff), wperm);
+                    break;
+                case ID_SW:
+                    m->write_mem(a + op->imm, b, wperm);
+                    break;
+                case ID_ADDI:
+                    x[op->rd] = ALU::add(a, op->imm);
+                    break;
+                case ID_SLTI:
+                    x[op->rd] = ALU::slt(a, op->imm);
+                    break;
+                case ID_SLTIU:
+                    x[op->rd] = ALU::sltu(a, op->imm);
+                    break;
+                case ID_XORI:
+                    x[op->rd] = ALU::xor_(a, op->imm);
+                    break;
+                case ID_ORI:
+                    x[op->rd] = ALU::or_(a, op->imm);
+                    break;
+                case ID_ANDI:
+                    x[op->rd] = ALU::and_(a, op->imm);
+                    break;
+                case ID_SLLI:
+                    x[op->rd] = ALU::sll(a, op->imm);
+                    break;
+                case ID_SRLI:
+                    x[op->rd] = ALU::srl(a, op->imm);
+                    break;
+                case ID_SRAI:
+                    x[op->rd] = ALU::sra(a, op->imm);
+                    break;
+                case ID_ADD:
+                    x[op->rd] = ALU::add(a, b);
+                    break;
+                case ID_SUB:
+                    x[op->rd] = ALU::sub(a, b);
+                    break;
+                case ID_SLL:
+                    x[op->rd] = ALU::sll(a, b);
+                    break;
+                case ID_SLT:
+                    x[op->rd] = ALU::slt(a, b);
+                    break;
+                case ID_SLTU:
+                    x[op->rd] = ALU::sltu(a, b);
+                    break;
+                case ID_XOR:
+                    x[op->rd] = ALU::xor_(a, b);
+                    break;
+                case ID_SRL:
+                    x[op->rd] = ALU::srl(a, b);
+                    break;
+                case ID_SRA:
+                    x[op->rd] = ALU::sra(a, b);
+                    break;
+                case ID_OR:
+                    x[op->rd] = ALU::or_(a, b);
+                    break;
+                case ID_AND:
+                    x[op->rd] = ALU::and_(a, b);
+                    break;
+                case ID_MUL:
+                    x[op->rd] = ALU::mul(a, b);
+                    break;
+                case ID_MULH:
+                    x[op->rd] = ALU::mulh(a, b);
+                    break;
+                case ID_MULHSU:
+                    x[op->rd] = ALU::mulhsu(a, b);
+                    break;
+                case ID_MULHU:
+                    x[op->rd] = ALU::mulhu(a, b);
+                    break;
+                case ID_DIV:
+                    x[op->rd] = ALU::div(a, b);
+                    break;
+                case ID_DIVU:
+                    x[op->rd] = ALU::divu(a, b);
+                    break;
+                case ID_REM:
+                    x[op->rd] = ALU::rem(a, b);
+                    break;
+                case ID_REMU:
+                    x[op->rd] = ALU::remu(a, b);
+                    break;
+                default:
+                    error_dump("スーパーブロックに対応していない命令です: %d\n", op->id);
+                }
+                if (op->branch && taken != op->taken)
+                {
+                    // サイドエグジット
+                    r->ip = op->exit_ip;
+                    break;
+                }
+                const SbOp *next = op + 1;
+                if (next == ops + n)
+                {
+                    if (!sb->loop || ++iterations >= max_iterations)
+                    {
+                        r->ip = op->next_ip;
+                        break;
+                    }
+                    next = ops;
+                }
+                // コードが書き換えられたか、ウォッチポイントに当たったか、次の命令の前にタイマ割り込みが入るなら抜ける
+                if (m->code_gen != gen || m->watch_hit || (intr_on && mtimer->is_timer_intr()))
+                {
+                    r->ip = op->next_ip;
+                    break;
+                }
+                stat->incr(op->id);
+                inst_count++;
+                op = next;
+                mtimer->incr_time(op->cost);
+            }
+        }
+        catch (Exception e)
+        {
+            bool store = op->id == ID_SB || op->id == ID_SH || op->id == ID_SW;
+            switch (e.cause)
+            {
+            case Cause::PageFault:
+                scause = store ? 1 << 15 : 1 << 13;
+                break;
+            case Cause::AccessFault:
+                scause = store ? 1 << 7 : 1 << 5;
+                break;
+            }
+            stval = e.stval;
+            trap = true;
+            r->ip = op->ip;
+        }
+        return op->id;
+    }
+
+    TraceRecord trace_record(uint32_t ip, Decoder *d)
+    {
+        TraceRecord rec = {};
+        rec.pc = ip;
+        rec.inst = d->code;
+        rec.rd = trace_no_rd;
+        if (trap)
+        {
+            rec.flags = TRACE_TRAP;
+            return rec;
+        }
+        rec.rd = trace_dest(d);
+        if (rec.rd < 32)
+        {
+            rec.wb = r->get_ireg(rec.rd);
+        }
+        else if (rec.rd != trace_no_rd)
+        {
+            rec.wb = r->get_freg_raw(rec.rd - 32);
+        }
+        switch (static_cast<Inst>(d->opcode()))
+        {
+        case Inst::LOAD:
+        case Inst::FLOAD:
+            rec.flags = TRACE_MEM_READ;
+            rec.addr = m->last_vaddr;
+            break;
+        case Inst::STORE:
+        case Inst::FSTORE:
+            rec.flags = TRACE_MEM_WRITE;
+            rec.addr = m->last_vaddr;
+            rec.data = m->last_wdata;
+            break;
+        default:
+            break;
+        }
+        return rec;
+    }
+
+  public:
+    Core(std::string filename, Settings *settings)
+    {
+        r = new Register;
+        io = new IO;
+        mtimer = new MTIMER();
+        m = new Memory(io, mtimer);
+        stat = new Stat;
+        disasm = new Disasm;
+        profiler = settings->profile ? new Profiler(settings->profile_interval) : nullptr;
+        // パイプラインモデルは関数毎の集計に呼び出しグラフを使う
+        callgraph = settings->callgraph || settings->pipeline ? new CallGraph(instruction_load_address) : nullptr;
+        pipeline = settings->pipeline ? new Pipeline(settings->pipeline_latency, settings->pipeline_freq) : nullptr;
+        tracer = settings->trace_file != "" ? new TraceWriter(settings->trace_file, settings->trace_compress) : nullptr;
+        cosim = settings->cosim_file != "" ? new Cosim(settings->cosim_file, settings->cosim_batch) : nullptr;
+        bpred = settings->bpred != "" ? new BranchPredictors(settings->bpred, settings->bpred_bits, settings->bpred_history, settings->bpred_ras) : nullptr;
+        hostperf = settings->hostperf ? new HostPerf(settings->hostperf_interval, settings->hostperf_sample, settings->hostperf_counters) : nullptr;
+        cache = nullptr;
+        timing = new TimingConfig;
+        if (settings->timing_file != "")
+        {
+            timing->load(settings->timing_file);
+        }
+        if (settings->cache)
+        {
+            unsigned l1 = 1, l2 = 10, mem = 40;
+            sscanf(settings->cache_latency.c_str(), "%u:%u:%u", &l1, &l2, &mem);
+            cache = new CacheSim(CacheSim::parse_level("L1I", settings->cache_l1i),
+                                 CacheSim::parse_level("L1D", settings->cache_l1d),
+                                 CacheSim::parse_level("L2", settings->cache_l2), l1, l2, mem);
+            m->cache = cache;
+            m->cache_timing = settings->cache_timing;
+            if (settings->cache_timing)
+            {
+                // メモリアクセスの時間はキャッシュのレイテンシで数える
+                timing->fetch = 0;
+                timing->class_cost[PIPE_LOAD] = 0;
+                timing->class_cost[PIPE_STORE] = 0;
+            }
+        }
+        m->uart_time = timing->uart;
+        m->led_time = timing->led;
+        m->mtimer_time = timing->mtimer;
+        decode_cache = new DecodeCache(timing);
+        fetch_fault.cost = timing->fetch;
+        fetch_fault.id = ID_UNKNOWN;
+        fetch_fault.valid = false;
+        fetch_fault.fuse_first = false;
+        // ブレークポイントのあるページでは融合とスーパーブロックを使わない (breakpoint_page)
+        bool observed = profiler || callgraph || tracer || cosim || cache || bpred ||
+                        settings->step_execution || settings->show_stack ||
+                        settings->show_registers || settings->show_inst_value || settings->show_io;
+        fusion = settings->fusion && !observed;
+        superblocks = settings->superblock && !observed ? new SuperblockCache : nullptr;
+        build_id = 0;
+        if (superblocks && settings->tcache_file != "")
+        {
+            build_id = emulator_build_id();
+            superblocks->load(settings->tcache_file, build_id);
+        }
+        hostperf_next = 1 << 20;
+        cpu_mode = Mode::Supervisor;
+        inst_count = 0;
+        sret_flag = false;
+        csr_unprivileged = false;
+        sscratch = 0;
+        sepc = 0;
+        stvec = 0;
+        scause = 0;
+        stval = 0;
+        sie = 0;
+        sip = 0;
+
+        sstatus = 0;
+        update_intr();
+        init_csr_file();
+
+        trap = false;
+
+        this->settings = settings;
+
+        symbols = new SymbolTable;
+        load_program(filename);
+        pk = nullptr;
+        if (settings->pk)
+        {
+            // ユーザモードから始めて、ecall はホストで処理する
+            pk = new ProxyKernel(settings->pk_root, settings->pk_freq);
+            pk->set_image_end(image_end);
+            cpu_mode = Mode::User;
+            r->set_ireg(default_stack_pointer, ProxyKernel::stack_top);
+        }
+        input_log = nullptr;
+        if (settings->record_file != "" || settings->replay_file != "" || settings->checkpoint_interval != 0)
+        {
+            // 外からの入力を命令数と一緒に記録し、再生するときはログから返す
+            // 逆実行で実行し直すときにも使うので、--record がなければ一時ファイルに記録する
+            bool replay = settings->replay_file != "";
+            input_log = new InputLog(replay ? settings->replay_file : settings->record_file, replay, &inst_count);
+            io->input_log = input_log;
+            if (pk)
+            {
+                pk->input_log = input_log;
+            }
+        }
+        checkpoints = nullptr;
+        event_at = ~0ull;
+        reexec = false;
+        reexec_target = 0;
+        last_hit = 0;
+        high_water = 0;
+        precise = false;
+        if (settings->checkpoint_interval != 0)
+        {
+            checkpoints = new CheckpointList(m, settings->checkpoint_interval, settings->checkpoint_keep);
+        }
+        if (settings->dirty_out != "")
+        {
+            m->start_dirty_tracking();
+        }
+        breakpoints = nullptr;
+        if (settings->break_point)
+        {
+            breakpoints = new Breakpoints;
+            for (uint32_t ip : settings->break_ips)
+            {
+                breakpoints->add(ip);
+            }
+            for (const std::string &spec : settings->watch_specs)
+            {
+                m->add_watchpoint(Breakpoints::parse_watch(spec));
+            }
+        }
+        gdb = nullptr;
+        gdb_poll_at = ~0ull;
+        fusion_allowed = fusion;
+        gdb_signal = 5;
+        break_before = false;
+        gdb_resume_count = 0;
+        if (settings->gdb != "")
+        {
+            gdb = new GdbStub(settings->gdb);
+            gdb_poll_at = 1 << 20;
+        }
+        update_event();
+        if (profiler)
+        {
+            profiler->symbols = symbols;
+        }
+        if (callgraph)
+        {
+            callgraph->symbols = symbols;
+            callgraph->set_entry(r->ip);
+        }
+        if (pipeline)
+        {
+            pipeline->symbols = symbols;
+        }
+    }
+
+    // ELF なら PT_LOAD のセグメントとシンボル表を、それ以外はそのまま instruction_load_address に置く
+    void load_program(const std::string &filename)
+    {
+        if (ElfFile::is_elf(filename))
+        {
+            ElfFile elf(filename);
+            image_end = 0;
+            for (const ElfFile::Segment &s : elf.segments())
+            {
+                m->map_file(s.paddr, elf.fd, s.offset, s.filesz, s.memsz);
+                image_end = std::max(image_end, s.paddr + s.memsz);
+            }
+            elf.read_symbols(symbols);
+            r->ip = elf.entry;
+            return;
+        }
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            error_dump("プログラムを開けませんでした: %s\n", filename.c_str());
+        }
+        m->map_file(instruction_load_address, fd, 0, st.st_size, st.st_size);
+        close(fd);
+        image_end = instruction_load_address + st.st_size;
+    }
+    ~Core()
+    {
+        delete checkpoints;
+        delete breakpoints;
+        delete gdb;
+        delete r;
+        delete m;
+        delete mtimer;
+        delete io;
+        delete stat;
+        delete disasm;
+        delete profiler;
+        delete callgraph;
+        delete tracer;
+        delete cosim;
+        delete cache;
+        delete bpred;
+        delete pipeline;
+        delete hostperf;
+        delete timing;
+        delete decode_cache;
+        delete superblocks;
+        delete symbols;
+        delete pk;
+        delete input_log;
+    }
+    void show_stack_from_top()
+    {
+        std::cout << "Stack" << std::endl;
+        m->show_data(r->get_ireg(default_stack_pointer), default_stack_dump_size);
+    }
+    void info()
+    {
+        if (!settings->hide_error_dump)
+        {
+            printf("inst_count: %llx\n", inst_count);
+            r->info();
+            show_stack_from_top();
+            io->show_status();
+            stat->show_stats();
+        }
+    }
+    // プロキシカーネルで exit したときの終了コード
+    int exit_code()
+    {
+        return pk ? pk->exit_code : 0;
+    }
+
+    // 終了時に書き出すレポート
+    // co-simulation の最後の (batch に満たない) 分が一致しなかったら false
+    bool write_reports()
+    {
+        if (input_log)
+        {
+            input_log->finish();
+        }
+        if (superblocks && settings->tcache_file != "")
+        {
+            superblocks->save(settings->tcache_file, build_id);
+        }
+        if (hostperf)
+        {
+            hostperf->write(settings->hostperf_out, inst_count);
+        }
+        if (settings->stat_out != "")
+        {
+            stat->write(settings->stat_out);
+        }
+        if (m->dirty_tracking())
+        {
+            m->write_dirty_pages(settings->dirty_out);
+        }
+        if (profiler)
+        {
+            profiler->write(settings->profile_out, 100);
+        }
+        if (callgraph && settings->callgraph)
+        {
+            callgraph->write(settings->callgraph_out);
+        }
+        if (pipeline)
+        {
+            pipeline->write(settings->pipeline_out, 100);
+        }
+        if (tracer)
+        {
+            tracer->close();
+        }
+        if (cache)
+        {
+            cache->write(settings->cache_out, 100);
+        }
+        if (bpred)
+        {
+            bpred->write(settings->bpred_out, inst_count, 100);
+        }
+        if (cosim)
+        {
+            if (!cosim->check())
+            {
+                return false;
+            }
+            fprintf(stderr, "cosim: %llu instructions matched, %llu left in the log\n",
+                    (unsigned long long)cosim->checked(), (unsigned long long)cosim->remaining());
+        }
+        return true;
+    }
+    void take_checkpoint()
+    {
+        Checkpoint &c = checkpoints->take(inst_count);
+        memcpy(c.regs, r->iregs(), sizeof(c.regs));
+        c.ip = r->ip;
+        c.csrs.clear();
+        for (const CsrEntry &e : csr_file)
+        {
+            if (e.reg)
+            {
+                c.csrs.push_back(this->*e.reg);
+            }
+        }
+        c.satp = m->read_satp();
+        c.mode = cpu_mode;
+        c.mtime = mtimer->get_mtime();
+        c.mtimecmp = mtimer->get_mtimecmp();
+        c.led = io->read_led();
+        c.input = input_log->mark();
+        if (pk)
+        {
+            c.pk = pk->state();
+        }
+        c.stat.assign(stat->count, stat->count + INST_ID_NUM);
+        if (callgraph)
+        {
+            c.callgraph = callgraph->state();
+        }
+    }
+
+    void restore_checkpoint(int k)
+    {
+        Checkpoint &c = checkpoints->restore(k);
+        memcpy(r->iregs(), c.regs, sizeof(c.regs));
+        r->ip = c.ip;
+        size_t i = 0;
+        for (const CsrEntry &e : csr_file)
+        {
+            if (e.reg)
+            {
+                this->*e.reg = c.csrs[i++];
+            }
+        }
+        m->write_satp(c.satp);
+        cpu_mode = (Mode)c.mode;
+        mtimer->restore(c.mtime, c.mtimecmp);
+        io->write_led(c.led);
+        input_log->rewind(c.input);
+        if (pk)
+        {
+            pk->restore(c.pk);
+        }
+        std::copy(c.stat.begin(), c.stat.end(), stat->count);
+        if (callgraph)
+        {
+            callgraph->restore(c.callgraph);
+        }
+        inst_count = c.inst_count;
+        trap = false;
+        sret_flag = false;
+        csr_unprivileged = false;
+        update_intr();
+    }
+
+    void set_muted(bool muted)
+    {
+        io->muted = muted;
+        if (pk)
+        {
+            pk->muted = muted;
+        }
+        if (profiler)
+        {
+            profiler->muted = muted;
+        }
+        if (callgraph)
+        {
+            callgraph->muted = muted;
+        }
+    }
+
+    void update_event()
+    {
+        event_at = ~0ull;
+        if (checkpoints)
+        {
+            event_at = checkpoints->next;
+        }
+        if (reexec)
+        {
+            event_at = std::min(event_at, reexec_target);
+        }
+        if (io->muted)
+        {
+            event_at = std::min(event_at, high_water);
+        }
+        if (gdb && !reexec)
+        {
+            event_at = std::min(event_at, gdb_poll_at);
+        }
+    }
+
+    // チェックポイントを取り、出力を戻し、実行し直しを終え、gdb を確かめる
+    // 実行し直しが終わったか、gdb が終了させたら true
+    bool at_event()
+    {
+        bool done = false;
+        if (checkpoints)
+        {
+            if (io->muted && inst_count >= high_water)
+            {
+                set_muted(false);
+            }
+            if (inst_count >= checkpoints->next)
+            {
+                take_checkpoint();
+            }
+            done = reexec && inst_count >= reexec_target;
+            if (done)
+            {
+                reexec = false;
+            }
+        }
+        if (gdb && !reexec && inst_count >= gdb_poll_at)
+        {
+            done = !gdb_poll();
+        }
+        update_event();
+        return done;
+    }
+
+    // 今のチェックポイントから target 命令目まで、止まらずに実行する
+    void reexecute(unsigned long long target)
+    {
+        set_muted(inst_count < high_water);
+        // target をちょうどで止まり、途中のブレークポイントも数えられるように1命令ずつ実行する
+        bool saved_fusion = fusion;
+        bool saved_precise = precise;
+        fusion = false;
+        precise = true;
+        reexec = true;
+        reexec_target = target;
+        update_event();
+        host_phase_enabled ? run_loop<true>() : run_loop<false>();
+        reexec = false;
+        fusion = saved_fusion;
+        precise = saved_precise;
+        update_event();
+    }
+
+    // target 命令目を実行し終えた所に戻る
+    bool reverse_to(unsigned long long target)
+    {
+        int k = checkpoints->find(target);
+        if (k < 0)
+        {
+            warn_dump("命令 %llx より前のチェックポイントは残っていません\n", target);
+            return false;
+        }
+        high_water = std::max(high_water, inst_count);
+        restore_checkpoint(k);
+        reexecute(target);
+        return true;
+    }
+
+    // 前にブレークポイント (ウォッチポイント) に当たった直後まで戻る
+    // 新しいチェックポイントから順に、次のチェックポイント (か今の位置) まで実行し直して探す
+    void reverse_continue()
+    {
+        high_water = std::max(high_water, inst_count);
+        unsigned long long end = inst_count;
+        int k;
+        while (settings->break_point && end != 0 && (k = checkpoints->find(end - 1)) >= 0)
+        {
+            restore_checkpoint(k);
+            unsigned long long start = inst_count;
+            last_hit = 0;
+            reexecute(end);
+            if (last_hit != 0)
+            {
+                reverse_to(last_hit);
+                return;
+            }
+            end = start;
+        }
+        warn_dump("ブレークポイントが見つからないので、残っている一番古いチェックポイントに戻ります\n");
+        restore_checkpoint(0);
+        set_muted(inst_count < high_water);
+        update_event();
+    }
+
+    // ip から始まる融合・スーパーブロックがブレークポイントを飛ばすかもしれないか
+    bool breakpoint_page(uint32_t ip)
+    {
+        return breakpoints && (breakpoints->on_page(ip) || breakpoints->on_page(ip + 4));
+    }
+
+    // ブレークポイントの命令を実行したか、ウォッチポイントの範囲にアクセスしたか
+    bool break_hit(uint32_t ip)
+    {
+        if (m->watch_hit)
+        {
+            m->watch_hit = false;
+            if (gdb && gdb->attached())
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%s:%x;", m->watch_access ? "awatch" : m->watch_write ? "watch" : "rwatch",
+                         m->watch_addr);
+                gdb_watch = buf;
+            }
+            else if (!reexec)
+            {
+                printf("watchpoint: %s %08x\n", m->watch_write ? "write" : "read", m->watch_addr);
+            }
+            return true;
+        }
+        return !break_before && breakpoints->hit(ip);
+    }
+
+    // ステップ実行・ブレークポイントで止まったときの入力
+    // c: 次のブレークポイントまで進む, rs: 1命令戻る, rc: 前のブレークポイントまで戻る, それ以外: 1命令進む
+    // 入力が終わったか q なら false
+    bool debug_prompt()
+    {
+        while (1)
+        {
+            std::string s;
+            if (!std::getline(std::cin, s) || s == "q")
+            {
+                return false;
+            }
+            if (checkpoints && (s == "rs" || s == "rc"))
+            {
+                if (s == "rs" && inst_count != 0)
+                {
+                    reverse_to(inst_count - 1);
+                }
+                else if (s == "rc")
+                {
+                    reverse_continue();
+                }
+                printf("inst_count: %llx, ip: %x\n", inst_count, r->ip);
+                continue;
+            }
+            if (s != "c")
+            {
+                settings->step_execution = true;
+            }
+            else if (settings->break_point)
+            {
+                settings->step_execution = false;
+            }
+            // ステップ実行の間は1命令ずつ止まれるようにする
+            precise = settings->step_execution;
+            fusion = fusion_allowed && !precise;
+            return true;
+        }
+    }
+
+    // ステップ実行・ブレークポイントで止まった。gdb がつながっていれば gdb に、なければ標準入力に聞く
+    // gdb が終了させたら false
+    bool debug_stop()
+    {
+        if (gdb && gdb->attached())
+        {
+            return gdb_session(5);
+        }
+        debug_prompt();
+        return true;
+    }
+
+    void gdb_attach()
+    {
+        warn_dump("gdb が接続しました\n");
+        settings->break_point = true;
+        if (!breakpoints)
+        {
+            breakpoints = new Breakpoints;
+        }
+        fusion = false;
+        precise = true;
+        break_before = true;
+    }
+    void gdb_detach()
+    {
+        gdb->detach();
+        break_before = false;
+        settings->break_point = !settings->break_ips.empty() || !settings->watch_specs.empty();
+        settings->step_execution = false;
+        fusion = fusion_allowed;
+        precise = false;
+    }
+
+    // 実行中に接続と Ctrl-C を確かめる。gdb が終了させたら false
+    bool gdb_poll()
+    {
+        gdb_poll_at = inst_count + (gdb->attached() ? 1 << 16 : 1 << 20);
+        if (!gdb->attached())
+        {
+            if (!gdb->accept_client(false))
+            {
+                return true;
+            }
+            gdb_attach();
+            return gdb_session(-1);
+        }
+        if (gdb->interrupted())
+        {
+            return gdb_session(2); // SIGINT
+        }
+        if (!gdb->attached())
+        {
+            gdb_detach();
+        }
+        return true;
+    }
+
+    void gdb_stop_reply(int sig)
+    {
+        char buf[8];
+        snprintf(buf, sizeof(buf), gdb_watch != "" ? "T%02x" : "S%02x", sig);
+        gdb->put_packet(buf + gdb_watch);
+        gdb_signal = sig;
+        gdb_watch = "";
+    }
+
+    // "addr,len" のような16進数の並び
+    static std::vector<uint32_t> gdb_args(const std::string &s)
+    {
+        std::vector<uint32_t> ret;
+        const char *p = s.c_str();
+        while (*p)
+        {
+            char *end;
+            ret.push_back(strtoul(p, &end, 16));
+            p = *end ? end + 1 : end;
+        }
+        return ret;
+    }
+
+    std::string gdb_target_xml()
+    {
+        static const char *names[] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "fp", "s1", "a0",
+                                      "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5",
+                                      "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+        std::string xml = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                          "<target version=\"1.0\"><architecture>riscv:rv32</architecture>"
+                          "<feature name=\"org.gnu.gdb.riscv.cpu\">";
+        for (int i = 0; i < 32; i++)
+        {
+            xml += std::string("<reg name=\"") + names[i] + "\" bitsize=\"32\" type=\"int\"/>";
+        }
+        xml += "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/></feature></target>";
+        return xml;
+    }
+
+    // gdb のコマンドを処理する。sig >= 0 なら先に止まった理由を送る
+    // 実行を続けるなら true、gdb が終了させたら false
+    bool gdb_session(int sig)
+    {
+        if (sig >= 0)
+        {
+            gdb_stop_reply(sig);
+        }
+        const std::string xfer_target = "Xfer:features:read:target.xml:";
+        std::string pkt;
+        while (gdb->get_packet(pkt))
+        {
+            if (pkt == "")
+            {
+                continue;
+            }
+            std::string arg = pkt.substr(1);
+            std::vector<uint32_t> a = gdb_args(arg.substr(0, arg.find(':')));
+            std::string reply = "";
+            switch (pkt[0])
+            {
+            case '?':
+                gdb_stop_reply(gdb_signal);
+                continue;
+            case 'g':
+                for (int i = 0; i < 32; i++)
+                {
+                    reply += GdbStub::hex_u32(r->get_ireg(i));
+                }
+                reply += GdbStub::hex_u32(r->ip);
+                break;
+            case 'G':
+                for (int i = 1; i < 32 && (size_t)i * 8 + 8 <= arg.size(); i++)
+                {
+                    r->set_ireg(i, GdbStub::parse_hex_u32(arg.substr(i * 8, 8)));
+                }
+                if (arg.size() >= 33 * 8)
+                {
+                    r->ip = GdbStub::parse_hex_u32(arg.substr(32 * 8, 8));
+                }
+                reply = "OK";
+                break;
+            case 'p':
+                if (a.empty())
+                {
+                    reply = "E00";
+                    break;
+                }
+                reply = a[0] < 32 ? GdbStub::hex_u32(r->get_ireg(a[0])) : a[0] == 32 ? GdbStub::hex_u32(r->ip) : "E00";
+                break;
+            case 'P':
+            {
+                if (a.empty())
+                {
+                    reply = "E00";
+                    break;
+                }
+                uint32_t val = GdbStub::parse_hex_u32(arg.substr(arg.find('=') + 1));
+                reply = "OK";
+                if (a[0] == 32)
+                {
+                    r->ip = val;
+                }
+                else if (a[0] > 0 && a[0] < 32)
+                {
+                    r->set_ireg(a[0], val);
+                }
+                else if (a[0] != 0)
+                {
+                    reply = "E00";
+                }
+                break;
+            }
+            case 'm':
+                for (uint32_t i = 0; a.size() == 2 && i < a[1]; i++)
+                {
+                    uint8_t v;
+                    if (!m->debug_read(a[0] + i, &v, mode_perm().read_on()))
+                    {
+                        break;
+                    }
+                    char buf[3];
+                    snprintf(buf, sizeof(buf), "%02x", v);
+                    reply += buf;
+                }
+                if (reply == "")
+                {
+                    reply = "E14";
+                }
+                break;
+            case 'M':
+            {
+                std::string data = arg.substr(arg.find(':') + 1);
+                reply = "OK";
+                for (uint32_t i = 0; a.size() == 2 && i < a[1] && i * 2 + 2 <= data.size(); i++)
+                {
+                    uint8_t v = strtoul(data.substr(i * 2, 2).c_str(), NULL, 16);
+                    if (!m->debug_write(a[0] + i, v, mode_perm().write_on()))
+                    {
+                        reply = "E14";
+                        break;
+                    }
+                }
+                break;
+            }
+            case 'c':
+            case 's':
+                if (!a.empty())
+                {
+                    r->ip = a[0];
+                }
+                settings->step_execution = pkt[0] == 's';
+                gdb_resume_count = inst_count;
+                return true;
+            case 'Z':
+            case 'z':
+            {
+                if (a.size() != 3 || a[0] > 4)
+                {
+                    break;
+                }
+                if (a[0] <= 1)
+                {
+                    pkt[0] == 'Z' ? breakpoints->add(a[1]) : breakpoints->remove(a[1]);
+                    reply = "OK";
+                    break;
+                }
+                // ウォッチポイントは物理アドレスで持ち、当たったら gdb が指定した仮想アドレスで返す
+                Watchpoint w = {a[1], std::max(a[2], 1u), a[0] != 2, a[0] != 3, a[1]};
+                try
+                {
+                    w.start = m->translate(a[1], mode_perm().read_on());
+                }
+                catch (Exception e)
+                {
+                    reply = "E01";
+                    break;
+                }
+                if ((uint64_t)w.vaddr + w.len > 1ull << 32 || (uint64_t)w.start + w.len > 1ull << 32)
+                {
+                    reply = "E01";
+                    break;
+                }
+                pkt[0] == 'Z' ? m->add_watchpoint(w) : m->remove_watchpoint(w);
+                reply = "OK";
+                break;
+            }
+            case 'b':
+                // 逆実行 (--checkpoint があるとき)
+                if (checkpoints && (arg == "s" || arg == "c"))
+                {
+                    if (arg == "s")
+                    {
+                        if (inst_count != 0)
+                        {
+                            reverse_to(inst_count - 1);
+                        }
+                    }
+                    else
+                    {
+                        reverse_continue();
+                    }
+                    gdb_stop_reply(5);
+                    continue;
+                }
+                break;
+            case 'q':
+                if (arg.compare(0, 9, "Supported") == 0)
+                {
+                    reply = "PacketSize=4000;qXfer:features:read+";
+                    if (checkpoints)
+                    {
+                        reply += ";ReverseStep+;ReverseContinue+";
+                    }
+                }
+                else if (arg == "Attached")
+                {
+                    reply = "1";
+                }
+                else if (arg == "fThreadInfo")
+                {
+                    reply = "m1";
+                }
+                else if (arg == "sThreadInfo")
+                {
+                    reply = "l";
+                }
+                else if (arg.compare(0, xfer_target.size(), xfer_target) == 0)
+                {
+                    std::vector<uint32_t> range = gdb_args(arg.substr(xfer_target.size()));
+                    std::string xml = gdb_target_xml();
+                    if (range.size() == 2)
+                    {
+                        std::string part = range[0] < xml.size() ? xml.substr(range[0], range[1]) : "";
+                        reply = (range[0] + part.size() < xml.size() ? "m" : "l") + part;
+                    }
+                }
+                break;
+            case 'H':
+            case 'T':
+                reply = "OK";
+                break;
+            case 'D':
+                gdb->put_packet("OK");
+                gdb_detach();
+                return true;
+            case 'k':
+                gdb_detach();
+                return false;
+            case 'v':
+                if (arg == "Kill;1" || arg.compare(0, 4, "Kill") == 0)
+                {
+                    gdb->put_packet("OK");
+                    gdb_detach();
+                    return false;
+                }
+                break;
+            default:
+                break;
+            }
+            gdb->put_packet(reply);
+        }
+        // 切断された
+        gdb_detach();
+        return true;
+    }
+
+    void main_loop()
+    {
+        if (hostperf)
+        {
+            hostperf->start();
+        }
+        if (gdb)
+        {
+            warn_dump("gdb の接続を待っています: %s\n", settings->gdb.c_str());
+            if (gdb->accept_client(true))
+            {
+                gdb_attach();
+                if (!gdb_session(-1))
+                {
+                    return;
+                }
+            }
+        }
+        while (1)
+        {
+            try
+            {
+                host_phase_enabled ? run_loop<true>() : run_loop<false>();
+                if (gdb && gdb->attached())
+                {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "W%02x", exit_code() & 0xff);
+                    gdb->put_packet(buf);
+                    gdb_detach();
+                }
+                return;
+            }
+            catch (int e)
+            {
+                // チェックポイントがあれば、止まった命令の直前に戻って調べられるようにする
+                // gdb がつながっていれば SIGILL で止まったことにする
+                bool gdb_on = gdb && gdb->attached();
+                if ((!checkpoints && !gdb_on) || reexec)
+                {
+                    throw;
+                }
+                if (checkpoints)
+                {
+                    if (!gdb_on)
+                    {
+                        warn_dump("命令 %llx の直前に戻ります (rs: 1命令戻る, rc: 前のブレークポイントまで戻る, q: 終わる)\n", inst_count);
+                    }
+                    fusion = false;
+                    precise = true;
+                    if (!reverse_to(inst_count))
+                    {
+                        throw;
+                    }
+                }
+                if (gdb_on ? !gdb_session(4) : !debug_prompt())
+                {
+                    throw;
+                }
+            }
+        }
+    }
+
+    // Phases: --hostperf のサンプリングのために今のフェーズを host_phase に書く
+    template <bool Phases>
+    void run_loop()
+    {
+        int mycount = 0;
+        bool block_head = true;
+        while (1)
+        {
+            if (inst_count >= event_at && at_event())
+            {
+                return;
+            }
+            if (break_before && !reexec && inst_count != gdb_resume_count && breakpoints->hit(r->ip))
+            {
+                if (!debug_stop())
+                {
+                    return;
+                }
+                continue;
+            }
+            Permission perm = mode_perm().read_on().exec_on();
+            uint32_t ip = r->ip;
+            uint32_t inst = 0;
+            if (cache)
+            {
+                cache->pc = ip;
+            }
+
+            // timer intr
+            if (intr_pending)
+            {
+                uint32_t sstatus1 = (sstatus >> 1) & 1;
+                sstatus = (cpu_mode == Mode::Supervisor ? 1 << 8 : 0) | (sstatus1 << 5);
+                update_intr();
+                cpu_mode = Mode::Supervisor;
+                // always Direct Mode
+                sepc = r->ip;
+                stval = 0;
+                scause = (1 << 31) | (1 << 5);
+                //printf("intr in %x \n", r->ip);
+                r->ip = stvec >> 2;
+                if (callgraph)
+                {
+                    callgraph->trap_enter(r->ip, sepc);
+                }
+                continue;
+            }
+            if (Phases)
+            {
+                host_phase = PHASE_FETCH;
+            }
+            try
+            {
+                inst = m->get_inst(ip, perm);
+            }
+            catch (Exception e)
+            {
+                switch (e.cause)
+                {
+                case Cause::PageFault:
+                    scause = 1 << 12; // INST PGFAULT
+                    break;
+                case Cause::AccessFault:
+                    scause = 1 << 1;
                     break;
                 }
                 stval = e.stval;
                 trap = true;
             }
-            Decoder d = Decoder(inst);
+            if (Phases)
+            {
+                host_phase = PHASE_DECODE;
+            }
+            DecodedInst *di = trap ? &fetch_fault : decode_cache->lookup(ip, inst);
+            Decoder &d = di->d;
+            mtimer->incr_time(di->cost);
+            if (callgraph)
+            {
+                callgraph->begin();
+            }
             if (!trap)
             {
-                run(&d);
+                if (Phases)
+                {
+                    host_phase = PHASE_EXECUTE;
+                }
+                InstId retired = di->id;
+                if (superblocks && !precise && block_head && !di->sb && !di->sb_failed && !breakpoint_page(ip))
+                {
+                    if (di->head_count == 0)
+                    {
+                        di->sb = superblocks->adopt(ip, perm, m, decode_cache);
+                    }
+                    if (!di->sb && ++di->head_count >= settings->superblock_threshold)
+                    {
+                        di->sb = superblocks->build(ip, perm, m, decode_cache);
+                        di->sb_failed = di->sb == nullptr;
+                    }
+                }
+                if (di->sb && !precise && !breakpoint_page(ip) && superblock_valid(di, ip, perm))
+                {
+                    retired = run_superblock(di->sb);
+                }
+                else if (fusion && di->fuse_first && !breakpoint_page(ip) && run_fused(di, ip, perm))
+                {
+                    retired = di->fuse_id;
+                }
+                else
+                {
+                    run(&d);
+                    if (superblocks && di->pipe.cls == PIPE_BRANCH)
+                    {
+                        if (r->ip != ip + 4)
+                        {
+                            di->taken++;
+                        }
+                        else
+                        {
+                            di->not_taken++;
+                        }
+                    }
+                }
+                if (!trap)
+                {
+                    stat->incr(retired);
+                }
+            }
+            block_head = r->ip != ip + 4;
+            if (Phases)
+            {
+                host_phase = PHASE_OTHER;
+            }
+            if (tracer)
+            {
+                tracer->push(trace_record(ip, &d));
+            }
+            if (pipeline && !trap)
+            {
+                pipeline->retire(di->pipe, r->ip != ip + 4, callgraph->current());
+            }
+            if (cosim && !trap && !cosim->retire(trace_record(ip, &d)))
+            {
+                error_dump("co-simulationの結果が一致しませんでした\n");
             }
             if (trap)
             {
                 // always delegate
                 uint32_t sstatus1 = (sstatus >> 1) & 1;
                 sstatus = (cpu_mode == Mode::Supervisor ? 1 << 8 : 0) | (sstatus1 << 5);
+                update_intr();
                 cpu_mode = Mode::Supervisor;
                 // always Direct Mode
                 sepc = r->ip;
                 //printf("in %x \n", r->ip);
                 r->ip = stvec >> 2;
                 trap = false;
+                if (callgraph)
+                {
+                    callgraph->trap_enter(r->ip, sepc);
+                }
             }
 
             // intr check
-            if (mtimer->is_timer_intr())
+            if (!((sip >> 5) & 1) && mtimer->is_timer_intr())
             {
                 sip = sip | (1 << 5);
+                update_intr();
             }
 
             csr_unprivileged = false;
             inst_count++;
+            if (callgraph)
+            {
+                callgraph->tick();
+            }
+            if (hostperf && inst_count >= hostperf_next)
+            {
+                hostperf->tick(inst_count);
+                hostperf_next = inst_count + (1 << 20);
+            }
+            if (profiler)
+            {
+                profiler->hit(ip);
+            }
+            if (pk && pk->halted)
+            {
+                break;
+            }
+            if (reexec)
+            {
+                if (settings->break_point && break_hit(ip) && inst_count < reexec_target)
+                {
+                    last_hit = inst_count;
+                }
+                else if (break_before && breakpoints->hit(ip))
+                {
+                    // 実行する前に止まる所
+                    last_hit = inst_count - 1;
+                }
+                continue;
+            }
             if (settings->show_inst_value)
             {
                 printf("inst_count: %llx\n", inst_count);
@@ -1786,25 +3229,11 @@ class Core
             {
                 io->show_status();
             }
-            if (settings->step_execution)
-            {
-                std::string s;
-                std::getline(std::cin, s);
-                if (settings->break_point && s == "c")
-                {
-                    settings->step_execution = false;
-                }
-            }
-            if (settings->break_point)
+            if ((settings->break_point && break_hit(ip)) || settings->step_execution)
             {
-                if (ip == settings->ip)
+                if (!debug_stop())
                 {
-                    std::string s;
-                    std::getline(std::cin, s);
-                    if (s != "c")
-                    {
-                        settings->step_execution = true;
-                    }
+                    return;
                 }
             }
         }
@@ -0,0 +1,164 @@
+// RTLシミュレーションのコミットログと1命令ずつ突き合わせる (lockstep co-simulation)
+// ログは --trace と同じ形式 (無圧縮) で、リタイアした命令だけを並べたもの
+// 該当しないフィールド (rdなしのwb, ロード以外のaddr等) は0にしておくこと
+class Cosim
+{
+    static const size_t context_size = 16;
+    // 読み終わった部分をこの単位でページキャッシュから捨てる
+    static const size_t release_bytes = 64 << 20;
+
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    const TraceRecord *log;
+    uint64_t log_len;
+    uint64_t pos; // batch[0] に対応するログの位置
+    uint64_t released;
+    bool diverged;
+
+    std::vector<TraceRecord> batch;
+    size_t batch_size;
+    Disasm disasm;
+
+    void print_diff(const TraceRecord &expect, const TraceRecord &actual)
+    {
+        printf("          %8s %8s\n", "expect", "actual");
+        printf("pc        %08x %08x%s\n", expect.pc, actual.pc, expect.pc != actual.pc ? " *" : "");
+        printf("inst      %08x %08x%s\n", expect.inst, actual.inst, expect.inst != actual.inst ? " *" : "");
+        printf("rd        %8d %8d%s\n", expect.rd, actual.rd, expect.rd != actual.rd ? " *" : "");
+        printf("wb        %08x %08x%s\n", expect.wb, actual.wb, expect.wb != actual.wb ? " *" : "");
+        printf("flags     %8x %8x%s\n", expect.flags, actual.flags, expect.flags != actual.flags ? " *" : "");
+        printf("addr      %08x %08x%s\n", expect.addr, actual.addr, expect.addr != actual.addr ? " *" : "");
+        printf("data      %08x %08x%s\n", expect.data, actual.data, expect.data != actual.data ? " *" : "");
+    }
+
+    void report(uint64_t n, const TraceRecord &actual)
+    {
+        printf("\n*** co-simulation diverged at retired instruction %llu ***\n", (unsigned long long)n);
+        uint64_t from = n > context_size ? n - context_size : 0;
+        for (uint64_t i = from; i < n; i++)
+        {
+            print_trace_record(i, log[i], &disasm);
+        }
+        if (n < log_len)
+        {
+            printf("expect: ");
+            print_trace_record(n, log[n], &disasm);
+        }
+        else
+        {
+            printf("expect: (end of log)\n");
+        }
+        printf("actual: ");
+        print_trace_record(n, actual, &disasm);
+        if (n < log_len)
+        {
+            print_diff(log[n], actual);
+        }
+        if (batch.size() > 1)
+        {
+            printf("(batch size %zu: state below is after %llu more instructions)\n",
+                   batch_size, (unsigned long long)(pos + batch.size() - n - 1));
+        }
+        std::cout << std::endl;
+    }
+
+    void release_consumed()
+    {
+        uint64_t consumed = sizeof(TraceHeader) + pos * sizeof(TraceRecord);
+        if (consumed - released < release_bytes)
+        {
+            return;
+        }
+        uint64_t end = consumed & ~(uint64_t)(release_bytes - 1);
+        madvise(map + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+
+  public:
+    Cosim(const std::string &filename, size_t batch_size)
+    {
+        this->batch_size = batch_size == 0 ? 1 : batch_size;
+        batch.reserve(this->batch_size);
+        pos = 0;
+        released = 0;
+        diverged = false;
+        fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            error_dump("コミットログを開けませんでした: %s\n", filename.c_str());
+        }
+        map_size = st.st_size;
+        if (map_size < sizeof(TraceHeader))
+        {
+            error_dump("コミットログではありません: %s\n", filename.c_str());
+        }
+        map = (uint8_t *)mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            error_dump("コミットログをmmapできませんでした: %s\n", filename.c_str());
+        }
+        madvise(map, map_size, MADV_SEQUENTIAL);
+        const TraceHeader *h = (const TraceHeader *)map;
+        if (memcmp(h->magic, trace_magic, sizeof(h->magic)) != 0 ||
+            h->version != trace_version || h->record_size != sizeof(TraceRecord))
+        {
+            error_dump("コミットログの形式が違います: %s\n", filename.c_str());
+        }
+        log = (const TraceRecord *)(map + sizeof(TraceHeader));
+        log_len = (map_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    }
+    ~Cosim()
+    {
+        munmap(map, map_size);
+        close(fd);
+    }
+
+    // リタイアした命令を1つ積む。不一致を見つけたらfalse
+    bool retire(const TraceRecord &rec)
+    {
+        batch.push_back(rec);
+        if (batch.size() < batch_size)
+        {
+            return true;
+        }
+        return check();
+    }
+
+    // 溜まっている分をまとめて比較する
+    bool check()
+    {
+        if (diverged)
+        {
+            return false;
+        }
+        size_t n = batch.size();
+        size_t avail = pos + n <= log_len ? n : log_len - pos;
+        if (memcmp(batch.data(), log + pos, avail * sizeof(TraceRecord)) != 0 || avail < n)
+        {
+            size_t i = 0;
+            while (i < avail && memcmp(&batch[i], &log[pos + i], sizeof(TraceRecord)) == 0)
+            {
+                i++;
+            }
+            report(pos + i, batch[i]);
+            diverged = true;
+            return false;
+        }
+        pos += n;
+        batch.clear();
+        release_consumed();
+        return true;
+    }
+
+    uint64_t checked()
+    {
+        return pos;
+    }
+
+    uint64_t remaining()
+    {
+        return log_len - pos;
+    }
+};
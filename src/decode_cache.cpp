@@ -0,0 +1,137 @@
+// デコード済み命令のキャッシュ
+// ipで引いて命令語が一致すればデコード結果を使い回す
+// (デコードは命令語だけで決まるので、書き換えやページの張り替えがあっても命令語の比較だけでよい)
+
+// 続く命令とまとめて1つのハンドラで実行するイディオム (マクロ命令融合)
+enum FuseKind : uint8_t
+{
+    FUSE_NONE,
+    FUSE_LUI_ADDI,   // lui rd + addi rd, rd, imm (32bit定数)
+    FUSE_AUIPC_JALR, // auipc rd + jalr rd2, imm(rd) (遠い呼び出し)
+    FUSE_SLT_BRANCH, // slt/sltu rd + beq/bne rd, x0
+    FUSE_ADDI_SP_LW, // addi sp, sp, imm + lw rd, imm(sp)
+    FUSE_ADDI_SP_SW, // addi sp, sp, imm + sw rs, imm(sp)
+};
+
+struct Superblock;
+
+struct DecodedInst
+{
+    Decoder d;
+    InstId id;
+    PipeInst pipe;
+    uint32_t cost; // フェッチを含めて進める仮想時間
+    bool valid;
+
+    // 融合できる組の1命令目になりうるか
+    bool fuse_first;
+    // 最後に調べた2命令目の命令語と、その組み合わせの結果
+    bool fuse_paired;
+    uint32_t fuse_code;
+    FuseKind fuse;
+    InstId fuse_id;
+    uint32_t fuse_cost;
+
+    // スーパーブロック用のプロファイル
+    uint32_t head_count; // 基本ブロックの先頭として実行された回数
+    uint32_t taken;      // 分岐した回数
+    uint32_t not_taken;  // 分岐しなかった回数
+    bool sb_failed;      // 作ろうとして作れなかった
+    Superblock *sb;
+};
+
+class DecodeCache
+{
+    static const uint32_t entry_num = 1 << 16;
+
+    std::vector<DecodedInst> entries;
+    TimingConfig *timing;
+
+    static bool is_fuse_first(Decoder &d, InstId id)
+    {
+        switch (id)
+        {
+        case ID_LUI:
+        case ID_AUIPC:
+        case ID_SLT:
+        case ID_SLTU:
+            return d.rd() != 0;
+        case ID_ADDI:
+            return d.rd() == 2 && d.rs1() == 2;
+        default:
+            return false;
+        }
+    }
+
+    static FuseKind fuse_kind(Decoder &a, InstId a_id, Decoder &b, InstId b_id)
+    {
+        switch (a_id)
+        {
+        case ID_LUI:
+            if (b_id == ID_ADDI && b.rd() == a.rd() && b.rs1() == a.rd())
+                return FUSE_LUI_ADDI;
+            break;
+        case ID_AUIPC:
+            if (b_id == ID_JALR && b.rs1() == a.rd())
+                return FUSE_AUIPC_JALR;
+            break;
+        case ID_SLT:
+        case ID_SLTU:
+            if ((b_id == ID_BEQ || b_id == ID_BNE) && b.rs1() == a.rd() && b.rs2() == 0)
+                return FUSE_SLT_BRANCH;
+            break;
+        case ID_ADDI:
+            if (b_id == ID_LW && b.rs1() == 2)
+                return FUSE_ADDI_SP_LW;
+            if (b_id == ID_SW && b.rs1() == 2)
+                return FUSE_ADDI_SP_SW;
+            break;
+        default:
+            break;
+        }
+        return FUSE_NONE;
+    }
+
+  public:
+    DecodeCache(TimingConfig *timing) : entries(entry_num)
+    {
+        this->timing = timing;
+        for (DecodedInst &e : entries)
+        {
+            e.valid = false;
+        }
+    }
+
+    DecodedInst *lookup(uint32_t ip, uint32_t code)
+    {
+        DecodedInst &e = entries[(ip >> 2) & (entry_num - 1)];
+        if (!e.valid || e.d.code != code)
+        {
+            e.d = Decoder(code);
+            e.id = e.d.inst_id();
+            e.pipe = pipe_inst(&e.d);
+            e.cost = timing->cost(e.pipe);
+            e.valid = true;
+            e.fuse_first = is_fuse_first(e.d, e.id);
+            e.fuse_paired = false;
+            e.head_count = 0;
+            e.taken = 0;
+            e.not_taken = 0;
+            e.sb_failed = false;
+            e.sb = nullptr;
+        }
+        return &e;
+    }
+
+    // 1命令目 e の次の命令語が code のときの融合の種類を求めて覚えておく
+    void pair(DecodedInst *e, uint32_t code)
+    {
+        Decoder b(code);
+        InstId b_id = b.inst_id();
+        e->fuse_paired = true;
+        e->fuse_code = code;
+        e->fuse = fuse_kind(e->d, e->id, b, b_id);
+        e->fuse_id = b_id;
+        e->fuse_cost = timing->cost(pipe_inst(&b));
+    }
+};
@@ -1,5 +1,10 @@
+// レジスタファイル上の、x0 への書き込みを捨てる位置
+static const int ireg_sink = 64;
+
 class Decoder
 {
+    friend class MicroBench;
+
     // get val's [l, r] bit value
     // ex) bit_range(00010011, 7, 1) -> 00010011
     uint32_t bit_range(uint32_t val, uint8_t l, uint8_t r)
@@ -11,9 +16,13 @@ class Decoder
 
   public:
     uint32_t code;
+    // 整数レジスタに書き込むときの位置 (rd が x0 なら ireg_sink)
+    uint8_t rd_slot;
+    Decoder() : code(0), rd_slot(ireg_sink) {}
     Decoder(uint32_t c)
     {
         code = c;
+        rd_slot = rd() == 0 ? ireg_sink : rd();
     }
     uint8_t opcode()
     {
@@ -35,6 +44,14 @@ class Decoder
     {
         return bit_range(code, 25, 21);
     }
+    uint8_t rs3()
+    {
+        return bit_range(code, 32, 28);
+    }
+    uint8_t fmt()
+    {
+        return bit_range(code, 27, 26);
+    }
     uint8_t funct3()
     {
         return bit_range(code, 15, 13);
@@ -54,6 +71,10 @@ class Decoder
         ret >>= 20;
         return ret;
     }
+    uint16_t csr()
+    {
+        return bit_range(code, 32, 21);
+    }
     uint32_t u_type_imm()
     {
         return bit_range(code, 32, 13) << 12;
@@ -86,5 +107,198 @@ class Decoder
         ret >>= 11;
         return ret;
     }
-};
 
+    // 命令番号 (対応していない命令は ID_UNKNOWN)
+    InstId inst_id()
+    {
+        uint8_t f3 = funct3();
+        uint16_t f7 = funct7();
+        switch (static_cast<Inst>(opcode()))
+        {
+        case Inst::LUI:
+            return ID_LUI;
+        case Inst::AUIPC:
+            return ID_AUIPC;
+        case Inst::JAL:
+            return ID_JAL;
+        case Inst::JALR:
+            return ID_JALR;
+        case Inst::BRANCH:
+            switch (static_cast<Branch_Inst>(f3))
+            {
+            case Branch_Inst::BEQ:
+                return ID_BEQ;
+            case Branch_Inst::BNE:
+                return ID_BNE;
+            case Branch_Inst::BLT:
+                return ID_BLT;
+            case Branch_Inst::BGE:
+                return ID_BGE;
+            case Branch_Inst::BLTU:
+                return ID_BLTU;
+            case Branch_Inst::BGEU:
+                return ID_BGEU;
+            }
+            break;
+        case Inst::LOAD:
+            switch (static_cast<Load_Inst>(f3))
+            {
+            case Load_Inst::LB:
+                return ID_LB;
+            case Load_Inst::LH:
+                return ID_LH;
+            case Load_Inst::LW:
+                return ID_LW;
+            case Load_Inst::LBU:
+                return ID_LBU;
+            case Load_Inst::LHU:
+                return ID_LHU;
+            }
+            break;
+        case Inst::STORE:
+            switch (static_cast<Store_Inst>(f3))
+            {
+            case Store_Inst::SB:
+                return ID_SB;
+            case Store_Inst::SH:
+                return ID_SH;
+            case Store_Inst::SW:
+                return ID_SW;
+            }
+            break;
+        case Inst::ALUI:
+            switch (static_cast<ALUI_Inst>(f3))
+            {
+            case ALUI_Inst::ADDI:
+                return ID_ADDI;
+            case ALUI_Inst::SLTI:
+                return ID_SLTI;
+            case ALUI_Inst::SLTIU:
+                return ID_SLTIU;
+            case ALUI_Inst::XORI:
+                return ID_XORI;
+            case ALUI_Inst::ORI:
+                return ID_ORI;
+            case ALUI_Inst::ANDI:
+                return ID_ANDI;
+            case ALUI_Inst::SLLI:
+                return ID_SLLI;
+            case ALUI_Inst::SRI:
+                return f7 == static_cast<uint16_t>(ALUI_SRI_Inst::SRAI) ? ID_SRAI : ID_SRLI;
+            }
+            break;
+        case Inst::ALU:
+            if (f7 == 1)
+            {
+                static const InstId mul_div[8] = {ID_MUL, ID_MULH, ID_MULHSU, ID_MULHU,
+                                                  ID_DIV, ID_DIVU, ID_REM, ID_REMU};
+                return mul_div[f3];
+            }
+            switch (static_cast<ALU_Inst>(f3))
+            {
+            case ALU_Inst::ADD_SUB:
+                return f7 == static_cast<uint16_t>(ALU_ADD_SUB_Inst::SUB) ? ID_SUB : ID_ADD;
+            case ALU_Inst::SLL:
+                return ID_SLL;
+            case ALU_Inst::SLT:
+                return ID_SLT;
+            case ALU_Inst::SLTU:
+                return ID_SLTU;
+            case ALU_Inst::XOR:
+                return ID_XOR;
+            case ALU_Inst::SR:
+                return f7 == static_cast<uint16_t>(ALU_SR_Inst::SRA) ? ID_SRA : ID_SRL;
+            case ALU_Inst::OR:
+                return ID_OR;
+            case ALU_Inst::AND:
+                return ID_AND;
+            }
+            break;
+        case Inst::FLOAD:
+            return ID_FLW;
+        case Inst::FSTORE:
+            return ID_FSW;
+        case Inst::FMADD:
+            return ID_FMADD;
+        case Inst::FMSUB:
+            return ID_FMSUB;
+        case Inst::FNMSUB:
+            return ID_FNMSUB;
+        case Inst::FNMADD:
+            return ID_FNMADD;
+        case Inst::FPU:
+            switch (static_cast<FPU_Inst>(f7))
+            {
+            case FPU_Inst::FADD:
+                return ID_FADD;
+            case FPU_Inst::FSUB:
+                return ID_FSUB;
+            case FPU_Inst::FMUL:
+                return ID_FMUL;
+            case FPU_Inst::FDIV:
+                return ID_FDIV;
+            case FPU_Inst::FSQRT:
+                return ID_FSQRT;
+            case FPU_Inst::FCVT_W_S:
+                return ID_FCVT_W_S;
+            case FPU_Inst::FCVT_S_W:
+                return ID_FCVT_S_W;
+            case FPU_Inst::FSGNJ:
+                switch (static_cast<FSgnj_Inst>(f3))
+                {
+                case FSgnj_Inst::FSGNJ:
+                    return ID_FSGNJ;
+                case FSgnj_Inst::FSGNJN:
+                    return ID_FSGNJN;
+                case FSgnj_Inst::FSGNJX:
+                    return ID_FSGNJX;
+                }
+                break;
+            case FPU_Inst::FCOMP:
+                switch (static_cast<FComp_Inst>(f3))
+                {
+                case FComp_Inst::FEQ:
+                    return ID_FEQ;
+                case FComp_Inst::FLT:
+                    return ID_FLT;
+                case FComp_Inst::FLE:
+                    return ID_FLE;
+                }
+                break;
+            default:
+                break;
+            }
+            break;
+        case Inst::SYSTEM:
+            switch (static_cast<System_Inst>(f3))
+            {
+            case System_Inst::CSRRW:
+                return ID_CSRRW;
+            case System_Inst::CSRRS:
+                return ID_CSRRS;
+            case System_Inst::CSRRC:
+                return ID_CSRRC;
+            case System_Inst::CSRRWI:
+                return ID_CSRRWI;
+            case System_Inst::CSRRSI:
+                return ID_CSRRSI;
+            case System_Inst::CSRRCI:
+                return ID_CSRRCI;
+            case System_Inst::PRIV:
+                if (f7 == static_cast<uint16_t>(Priv_Inst::SRET))
+                {
+                    return ID_SRET;
+                }
+                if (f7 == static_cast<uint16_t>(Priv_Inst::ECALL))
+                {
+                    return ID_ECALL;
+                }
+                break;
+            }
+            break;
+        default:
+            break;
+        }
+        return ID_UNKNOWN;
+    }
+};
@@ -48,71 +48,262 @@ class Disasm
     uint32_t src;
     uint32_t src1;
     uint32_t src2;
+    uint32_t src3;
     uint32_t base;
 
-    void print_inst(std::string type){
+    // print_inst と同じ1行 (改行なし)
+    std::string inst_string(std::string type){
+        std::ostringstream os;
         if(type == "r"){
-            std::cout << inst_name << ", "
-                      << reg(dest) << ","
-                      << reg(src1) << ","
-                      << reg(src2) << std::endl;
+            os << inst_name << ", "
+                  << reg(dest) << ","
+                  << reg(src1) << ","
+                  << reg(src2);
         }
         else if(type == "i"){
-            std::cout << inst_name << ", "
-                      << reg(dest) << ","
-                      << reg(base) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << reg(dest) << ","
+                  << reg(base) << ","
+                  << imm;
         }
         else if(type == "s"){
-            std::cout << inst_name << ", "
-                      << reg(src) << ","
-                      << reg(base) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << reg(src) << ","
+                  << reg(base) << ","
+                  << imm;
         }
         else if(type == "b"){
-            std::cout << inst_name << ", "
-                      << reg(src1) << ","
-                      << reg(src2) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << reg(src1) << ","
+                  << reg(src2) << ","
+                  << imm;
         }
         else if(type == "u" || type == "j"){
-            std::cout << inst_name << ", "
-                      << reg(dest) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << reg(dest) << ","
+                  << imm;
         }
         else if(type == "fr"){
-            std::cout << inst_name << ", "
-                      << freg(dest) << ","
-                      << freg(src1) << ","
-                      << freg(src2) << std::endl;
+            os << inst_name << ", "
+                  << freg(dest) << ","
+                  << freg(src1) << ","
+                  << freg(src2);
+        }
+        else if(type == "fr4"){
+            os << inst_name << ", "
+                  << freg(dest) << ","
+                  << freg(src1) << ","
+                  << freg(src2) << ","
+                  << freg(src3);
         }
         else if(type == "fi"){
-            std::cout << inst_name << ", "
-                      << freg(dest) << ","
-                      << reg(base) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << freg(dest) << ","
+                  << reg(base) << ","
+                  << imm;
         }
         else if(type == "fs"){
-            std::cout << inst_name << ", "
-                      << freg(src) << ","
-                      << reg(base) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << freg(src) << ","
+                  << reg(base) << ","
+                  << imm;
         }
         else if(type == "fb"){
-            std::cout << inst_name << ", "
-                      << freg(src1) << ","
-                      << freg(src2) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << freg(src1) << ","
+                  << freg(src2) << ","
+                  << imm;
         }
         else if(type == "fu" || type == "fj"){
-            std::cout << inst_name << ", "
-                      << freg(dest) << ","
-                      << imm << std::endl;
+            os << inst_name << ", "
+                  << freg(dest) << ","
+                  << imm;
         }
         else if(type == "fR"){
-            std::cout << inst_name << ", "
-                      << freg(dest) << ","
-                      << freg(src1) << std::endl;
+            os << inst_name << ", "
+                  << freg(dest) << ","
+                  << freg(src1);
+        }
+        else if(type == "c"){
+            os << inst_name << ", "
+                  << reg(dest) << ","
+                  << std::hex << "0x" << imm << std::dec << ","
+                  << reg(src1);
+        }
+        else if(type == "n"){
+            os << inst_name;
+        }
+        else{
+            os << "unknown";
+        }
+        return os.str();
+    }
+
+    void print_inst(std::string type){
+        std::cout << inst_string(type) << std::endl;
+    }
+
+    // 実行せずに命令語だけから type/inst_name/オペランドを埋める
+    // (トレースのデコーダなどCoreの外で使う)
+    void decode(Decoder *d){
+        static const char *branch_names[] = {"beq", "bne", "", "", "blt", "bge", "bltu", "bgeu"};
+        static const char *load_names[] = {"lb", "lh", "lw", "", "lbu", "lhu", "", ""};
+        static const char *store_names[] = {"sb", "sh", "sw", "", "", "", "", ""};
+        static const char *alui_names[] = {"addi", "slli", "slti", "sltiu", "xori", "", "ori", "andi"};
+        static const char *alu_names[] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+        static const char *mul_div_names[] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+        static const char *csr_names[] = {"", "csrrw", "csrrs", "csrrc", "", "csrrwi", "csrrsi", "csrrci"};
+
+        type = "";
+        inst_name = "";
+        dest = d->rd();
+        src = d->rs2();
+        src1 = d->rs1();
+        src2 = d->rs2();
+        src3 = d->rs3();
+        base = d->rs1();
+        imm = 0;
+        switch (static_cast<Inst>(d->opcode()))
+        {
+        case Inst::LUI:
+        case Inst::AUIPC:
+            type = "u";
+            inst_name = static_cast<Inst>(d->opcode()) == Inst::LUI ? "lui" : "auipc";
+            imm = d->u_type_imm();
+            break;
+        case Inst::JAL:
+            type = "j";
+            inst_name = "jal";
+            imm = d->jal_imm();
+            break;
+        case Inst::JALR:
+            type = "i";
+            inst_name = "jalr";
+            imm = d->i_type_imm();
+            break;
+        case Inst::BRANCH:
+            type = "b";
+            inst_name = branch_names[d->funct3()];
+            imm = d->b_type_imm();
+            break;
+        case Inst::LOAD:
+            type = "i";
+            inst_name = load_names[d->funct3()];
+            imm = d->i_type_imm();
+            break;
+        case Inst::STORE:
+            type = "s";
+            inst_name = store_names[d->funct3()];
+            imm = d->s_type_imm();
+            break;
+        case Inst::ALUI:
+            type = "i";
+            inst_name = alui_names[d->funct3()];
+            if (static_cast<ALUI_Inst>(d->funct3()) == ALUI_Inst::SRI)
+            {
+                inst_name = d->funct7() == static_cast<uint8_t>(ALUI_SRI_Inst::SRAI) ? "srai" : "srli";
+            }
+            imm = d->i_type_imm();
+            break;
+        case Inst::ALU:
+            type = "r";
+            inst_name = d->funct7() == 1 ? mul_div_names[d->funct3()] : alu_names[d->funct3()];
+            if (d->funct7() == 0b0100000)
+            {
+                inst_name = static_cast<ALU_Inst>(d->funct3()) == ALU_Inst::ADD_SUB ? "sub" : "sra";
+            }
+            break;
+        case Inst::FLOAD:
+            type = "fi";
+            inst_name = "flw";
+            imm = d->i_type_imm();
+            break;
+        case Inst::FSTORE:
+            type = "fs";
+            inst_name = "fsw";
+            imm = d->s_type_imm();
+            break;
+        case Inst::FMADD:
+            type = "fr4";
+            inst_name = "fmadd";
+            break;
+        case Inst::FMSUB:
+            type = "fr4";
+            inst_name = "fmsub";
+            break;
+        case Inst::FNMSUB:
+            type = "fr4";
+            inst_name = "fnmsub";
+            break;
+        case Inst::FNMADD:
+            type = "fr4";
+            inst_name = "fnmadd";
+            break;
+        case Inst::FPU:
+            type = "fr";
+            switch (static_cast<FPU_Inst>(d->funct5_fmt()))
+            {
+            case FPU_Inst::FADD:
+                inst_name = "fadd";
+                break;
+            case FPU_Inst::FSUB:
+                inst_name = "fsub";
+                break;
+            case FPU_Inst::FMUL:
+                inst_name = "fmul";
+                break;
+            case FPU_Inst::FDIV:
+                inst_name = "fdiv";
+                break;
+            case FPU_Inst::FSQRT:
+                type = "fR";
+                inst_name = "fsqrt";
+                break;
+            case FPU_Inst::FCVT_W_S:
+                type = "fR";
+                inst_name = "fcvt_w_s";
+                break;
+            case FPU_Inst::FCVT_S_W:
+                type = "fR";
+                inst_name = "fcvt_s_w";
+                break;
+            case FPU_Inst::FMV_X_W:
+                type = "fR";
+                inst_name = "fmv_x_w";
+                break;
+            case FPU_Inst::FMV_W_X:
+                type = "fR";
+                inst_name = "fmv_w_x";
+                break;
+            case FPU_Inst::FCOMP:
+                inst_name = d->funct3() == 0b010 ? "feq" : d->funct3() == 0b001 ? "flt" : "fle";
+                break;
+            case FPU_Inst::FSGNJ:
+                inst_name = d->funct3() == 0b000 ? "fsgnj" : d->funct3() == 0b001 ? "fsgnjn" : "fsgnjx";
+                break;
+            default:
+                type = "";
+            }
+            break;
+        case Inst::SYSTEM:
+            if (static_cast<System_Inst>(d->funct3()) == System_Inst::PRIV)
+            {
+                type = "n";
+                inst_name = d->funct7() == static_cast<uint8_t>(Priv_Inst::SRET) ? "sret" : "ecall";
+            }
+            else
+            {
+                type = "c";
+                inst_name = csr_names[d->funct3()];
+                imm = d->i_type_imm() & 0xfff;
+            }
+            break;
+        default:
+            break;
+        }
+        if (type != "" && inst_name == "")
+        {
+            type = "";
         }
     }
 };
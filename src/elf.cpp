@@ -0,0 +1,172 @@
+// ELF32 (RISC-V) の実行ファイルとシンボル表
+// PT_LOAD のセグメントを物理アドレス (p_paddr) に置き、.symtab を PC の名前解決に使う
+
+struct Symbol
+{
+    uint32_t addr;
+    uint32_t size;
+    std::string name;
+};
+
+class SymbolTable
+{
+    std::vector<Symbol> syms; // addr 順
+
+  public:
+    void add(uint32_t addr, uint32_t size, const std::string &name)
+    {
+        syms.push_back({addr, size, name});
+    }
+    void sort()
+    {
+        std::stable_sort(syms.begin(), syms.end(), [](const Symbol &a, const Symbol &b) {
+            return a.addr < b.addr;
+        });
+    }
+    bool empty()
+    {
+        return syms.empty();
+    }
+
+    // addr を含むシンボル (大きさが 0 なら直前のもの)。なければ nullptr
+    const Symbol *find(uint32_t addr)
+    {
+        auto it = std::upper_bound(syms.begin(), syms.end(), addr, [](uint32_t a, const Symbol &s) {
+            return a < s.addr;
+        });
+        if (it == syms.begin())
+        {
+            return nullptr;
+        }
+        --it;
+        if (it->size != 0 && addr - it->addr >= it->size)
+        {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    // "name" か "name+0x10"。見つからなければ ""
+    std::string describe(uint32_t addr)
+    {
+        const Symbol *s = find(addr);
+        if (s == nullptr)
+        {
+            return "";
+        }
+        if (s->addr == addr)
+        {
+            return s->name;
+        }
+        char buf[16];
+        snprintf(buf, sizeof(buf), "+0x%x", addr - s->addr);
+        return s->name + buf;
+    }
+};
+
+class ElfFile
+{
+    std::string filename;
+
+    void read_at(void *buf, size_t len, uint64_t offset)
+    {
+        if (pread(fd, buf, len, offset) != (ssize_t)len)
+        {
+            error_dump("ELFファイルを読めませんでした: %s\n", filename.c_str());
+        }
+    }
+
+  public:
+    struct Segment
+    {
+        uint32_t paddr;
+        uint32_t offset;
+        uint32_t filesz;
+        uint32_t memsz;
+    };
+
+    int fd;
+    Elf32_Ehdr header;
+    uint32_t entry;
+
+    static bool is_elf(const std::string &filename)
+    {
+        char magic[SELFMAG];
+        std::ifstream ifs(filename, std::ios::binary);
+        return ifs.read(magic, SELFMAG) && memcmp(magic, ELFMAG, SELFMAG) == 0;
+    }
+
+    ElfFile(const std::string &filename) : filename(filename)
+    {
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error_dump("ELFファイルを開けませんでした: %s\n", filename.c_str());
+        }
+        read_at(&header, sizeof(header), 0);
+        if (header.e_ident[EI_CLASS] != ELFCLASS32 || header.e_ident[EI_DATA] != ELFDATA2LSB)
+        {
+            error_dump("32bitリトルエンディアンのELFではありません: %s\n", filename.c_str());
+        }
+        if (header.e_machine != EM_RISCV || header.e_type != ET_EXEC)
+        {
+            error_dump("RISC-Vの実行ファイルではありません: %s\n", filename.c_str());
+        }
+        entry = header.e_entry;
+    }
+    ~ElfFile()
+    {
+        close(fd);
+    }
+
+    std::vector<Segment> segments()
+    {
+        std::vector<Segment> ret;
+        for (int i = 0; i < header.e_phnum; i++)
+        {
+            Elf32_Phdr ph;
+            read_at(&ph, sizeof(ph), header.e_phoff + (uint64_t)i * header.e_phentsize);
+            if (ph.p_type == PT_LOAD && ph.p_memsz != 0)
+            {
+                ret.push_back({ph.p_paddr, ph.p_offset, ph.p_filesz, ph.p_memsz});
+            }
+        }
+        return ret;
+    }
+
+    // .symtab の関数とラベルを syms に入れる (.L で始まる局所ラベルとマッピングシンボルは除く)
+    void read_symbols(SymbolTable *syms)
+    {
+        for (int i = 0; i < header.e_shnum; i++)
+        {
+            Elf32_Shdr sh;
+            read_at(&sh, sizeof(sh), header.e_shoff + (uint64_t)i * header.e_shentsize);
+            if (sh.sh_type != SHT_SYMTAB || sh.sh_entsize != sizeof(Elf32_Sym))
+            {
+                continue;
+            }
+            Elf32_Shdr str;
+            read_at(&str, sizeof(str), header.e_shoff + (uint64_t)sh.sh_link * header.e_shentsize);
+            std::vector<char> names(str.sh_size + 1, '\0');
+            read_at(names.data(), str.sh_size, str.sh_offset);
+            std::vector<Elf32_Sym> es(sh.sh_size / sizeof(Elf32_Sym));
+            read_at(es.data(), es.size() * sizeof(Elf32_Sym), sh.sh_offset);
+            for (const Elf32_Sym &s : es)
+            {
+                int type = ELF32_ST_TYPE(s.st_info);
+                if ((type != STT_FUNC && type != STT_NOTYPE) || s.st_shndx == SHN_UNDEF ||
+                    s.st_shndx == SHN_ABS || s.st_name >= str.sh_size)
+                {
+                    continue;
+                }
+                const char *name = names.data() + s.st_name;
+                if (name[0] == '\0' || name[0] == '$' || strncmp(name, ".L", 2) == 0)
+                {
+                    continue;
+                }
+                syms->add(s.st_value, s.st_size, name);
+            }
+        }
+        syms->sort();
+    }
+};
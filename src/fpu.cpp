@@ -309,6 +309,143 @@ class FPU
         return y;
     }
 
+    // x1 * x2 + x3 with a single rounding (round to nearest even).
+    // Like fadd/fmul, subnormal inputs are flushed to zero and results
+    // that underflow become a signed zero.
+    static uint32_t fmadd(uint32_t x1, uint32_t x2, uint32_t x3)
+    {
+        uint32_t s1 = bit_range(x1, 32, 32); //1bit
+        uint32_t s2 = bit_range(x2, 32, 32); //1bit
+        uint32_t s3 = bit_range(x3, 32, 32); //1bit
+        uint32_t e1 = bit_range(x1, 31, 24); //8bit
+        uint32_t e2 = bit_range(x2, 31, 24); //8bit
+        uint32_t e3 = bit_range(x3, 31, 24); //8bit
+        uint32_t m1 = bit_range(x1, 23, 1); //23bit
+        uint32_t m2 = bit_range(x2, 23, 1); //23bit
+        uint32_t m3 = bit_range(x3, 23, 1); //23bit
+
+        uint32_t sp = s1 ^ s2; //1bit
+        uint32_t qnan = (255 << 23) + (1 << 22);
+
+        // inf / nan
+        if (e1 == 255 || e2 == 255 || e3 == 255)
+        {
+            if ((e1 == 255 && m1 != 0) || (e2 == 255 && m2 != 0) || (e3 == 255 && m3 != 0))
+                return qnan;
+            if ((e1 == 255 && e2 == 0) || (e2 == 255 && e1 == 0))
+                return qnan;
+            if (e1 == 255 || e2 == 255)
+            {
+                if (e3 == 255 && s3 != sp)
+                    return qnan;
+                return (sp << 31) + (255 << 23);
+            }
+            return (s3 << 31) + (255 << 23);
+        }
+
+        bool pzero = e1 == 0 || e2 == 0;
+        bool czero = e3 == 0;
+        if (pzero && czero)
+            return (sp & s3) << 31;
+        if (pzero)
+            return (s3 << 31) + (e3 << 23) + m3;
+
+        // product is exact: 2.46 fixed point, 3 extra bits for guard/round/sticky
+        uint64_t mp = ((uint64_t)((1 << 23) + m1) * (uint64_t)((1 << 23) + m2)) << 3; //51bit
+        int32_t ep = (int32_t)e1 + (int32_t)e2 - 127;                              //10bit signed
+        uint64_t mc = czero ? 0 : (uint64_t)((1 << 23) + m3) << 26;                 //50bit
+        int32_t ec = czero ? ep : (int32_t)e3;
+
+        // align the smaller operand, keeping shifted out bits as sticky
+        uint64_t ml, msm; //51bit
+        uint32_t sl, ssm;
+        int32_t el;
+        if (ep >= ec)
+        {
+            ml = mp, msm = mc, sl = sp, ssm = s3, el = ep;
+        }
+        else
+        {
+            ml = mc, msm = mp, sl = s3, ssm = sp, el = ec;
+        }
+        int32_t de = el - (ep >= ec ? ec : ep);
+        if (de > 60)
+        {
+            msm = msm != 0;
+        }
+        else if (de > 0)
+        {
+            uint32_t stck = bit_range64(msm, de, 1) != 0;
+            msm = (msm >> de) | stck;
+        }
+
+        uint64_t mye; //52bit
+        uint32_t sy;
+        if (sl == ssm)
+        {
+            mye = ml + msm;
+            sy = sl;
+        }
+        else if (ml >= msm)
+        {
+            mye = ml - msm;
+            sy = sl;
+        }
+        else
+        {
+            mye = msm - ml;
+            sy = ssm;
+        }
+        if (mye == 0)
+            return (sp & s3) << 31;
+
+        // normalize so that the hidden bit sits at bit 26 (24bit mantissa + guard + sticky)
+        int32_t lz = 63;
+        while (!bit_range64(mye, lz + 1, lz + 1))
+            lz--;
+        int32_t ey = el + (lz - 49);
+        uint64_t myf; //26bit
+        if (lz > 25)
+        {
+            uint32_t stck = bit_range64(mye, lz - 25, 1) != 0;
+            myf = (mye >> (lz - 25)) | stck;
+        }
+        else
+        {
+            myf = mye << (25 - lz);
+        }
+
+        uint32_t my = bit_range64(myf, 26, 3); //24bit
+        if (bit_range64(myf, 2, 2) && (bit_range64(myf, 1, 1) || bit_range(my, 1, 1)))
+            my += 1;
+        if (bit_range(my, 25, 25))
+        {
+            my >>= 1;
+            ey += 1;
+        }
+
+        if (ey >= 255)
+            return (sy << 31) + (255 << 23);
+        if (ey <= 0)
+            return sy << 31;
+        return (sy << 31) + (ey << 23) + bit_range(my, 23, 1);
+    }
+
+    static uint32_t fmsub(uint32_t x1, uint32_t x2, uint32_t x3)
+    {
+        return fmadd(x1, x2, x3 ^ (1u << 31));
+    }
+
+    static uint32_t fnmsub(uint32_t x1, uint32_t x2, uint32_t x3)
+    {
+        return fmadd(x1 ^ (1u << 31), x2, x3);
+    }
+
+    static uint32_t fnmadd(uint32_t x1, uint32_t x2, uint32_t x3)
+    {
+        return fmadd(x1 ^ (1u << 31), x2, x3 ^ (1u << 31));
+    }
+
     static uint32_t finv(uint32_t x)
     {
         using namespace std;
@@ -317,7 +454,7 @@ class FPU
         uint32_t m = bit_range(x, 23, 1); //23bit
 
         uint32_t ma = (1 << 23) + m; //24bit
-        uint32_t init = map(bit_range(m,23,19)); //8bit
+        uint32_t init = ::map(bit_range(m,23,19)); //8bit
 
         uint64_t calc1 = ((uint64_t)init << 31) - (uint64_t)init*(uint64_t)init*(uint64_t)ma; //39bit
 
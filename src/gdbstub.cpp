@@ -0,0 +1,229 @@
+// GDB のリモートシリアルプロトコル (RSP) の通信部分
+// address が数字だけなら 127.0.0.1 の TCP ポート、それ以外は Unix ドメインソケットのパスで待つ
+// パケット ($data#xx) の送受信と、実行中の Ctrl-C (0x03) の検出だけを受け持ち、
+// コマンドの中身は Core が処理する
+class GdbStub
+{
+    int listen_fd;
+    int fd;
+    std::string unix_path;
+
+    bool read_byte(uint8_t *c)
+    {
+        while (1)
+        {
+            ssize_t n = recv(fd, c, 1, 0);
+            if (n == 1)
+            {
+                return true;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+    }
+    void write_all(const std::string &s)
+    {
+        size_t done = 0;
+        while (done < s.size())
+        {
+            ssize_t n = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                return;
+            }
+            done += n;
+        }
+    }
+    // timeout_ms だけ待って読めるか
+    static bool readable(int fd, int timeout_ms)
+    {
+        struct pollfd p = {fd, POLLIN, 0};
+        return poll(&p, 1, timeout_ms) > 0;
+    }
+
+  public:
+    GdbStub(const std::string &address) : fd(-1)
+    {
+        bool tcp = address != "" && address.find_first_not_of("0123456789") == std::string::npos;
+        if (tcp)
+        {
+            listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            int one = 1;
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            struct sockaddr_in sa = {};
+            sa.sin_family = AF_INET;
+            sa.sin_port = htons(atoi(address.c_str()));
+            sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+            {
+                error_dump("gdb のポートを開けませんでした: %s\n", address.c_str());
+            }
+        }
+        else
+        {
+            listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            struct sockaddr_un sa = {};
+            sa.sun_family = AF_UNIX;
+            if (address.size() >= sizeof(sa.sun_path))
+            {
+                error_dump("gdb のソケットのパスが長すぎます: %s\n", address.c_str());
+            }
+            strcpy(sa.sun_path, address.c_str());
+            unlink(address.c_str());
+            if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+            {
+                error_dump("gdb のソケットを開けませんでした: %s\n", address.c_str());
+            }
+            unix_path = address;
+        }
+        if (listen(listen_fd, 1) != 0)
+        {
+            error_dump("gdb の接続を待てませんでした: %s\n", address.c_str());
+        }
+    }
+    ~GdbStub()
+    {
+        detach();
+        close(listen_fd);
+        if (unix_path != "")
+        {
+            unlink(unix_path.c_str());
+        }
+    }
+
+    bool attached()
+    {
+        return fd >= 0;
+    }
+
+    // 接続を待つ。wait でなければ、来ていなければすぐに false を返す
+    bool accept_client(bool wait)
+    {
+        if (!wait && !readable(listen_fd, 0))
+        {
+            return false;
+        }
+        fd = accept(listen_fd, nullptr, nullptr);
+        if (fd >= 0)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return fd >= 0;
+    }
+
+    void detach()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // 実行中に Ctrl-C が届いたか (切断されたら detach する)
+    bool interrupted()
+    {
+        while (attached() && readable(fd, 0))
+        {
+            uint8_t c;
+            if (!read_byte(&c))
+            {
+                detach();
+                return false;
+            }
+            if (c == 0x03)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 次のパケットの中身。切断されたら false
+    bool get_packet(std::string &data)
+    {
+        uint8_t c;
+        while (1)
+        {
+            do
+            {
+                if (!read_byte(&c))
+                {
+                    detach();
+                    return false;
+                }
+            } while (c != '$');
+            data.clear();
+            uint8_t sum = 0;
+            while (read_byte(&c) && c != '#')
+            {
+                data += c;
+                sum += c;
+            }
+            char cs[3] = {0};
+            if (c != '#' || !read_byte((uint8_t *)&cs[0]) || !read_byte((uint8_t *)&cs[1]))
+            {
+                detach();
+                return false;
+            }
+            if (strtoul(cs, NULL, 16) == sum)
+            {
+                write_all("+");
+                return true;
+            }
+            write_all("-");
+        }
+    }
+
+    void put_packet(const std::string &data)
+    {
+        uint8_t sum = 0;
+        for (char c : data)
+        {
+            sum += c;
+        }
+        char cs[4];
+        snprintf(cs, sizeof(cs), "#%02x", sum);
+        std::string pkt = "$" + data + cs;
+        // '-' が返ってきたら送り直す
+        for (int retry = 0; retry < 3 && attached(); retry++)
+        {
+            write_all(pkt);
+            uint8_t ack;
+            if (!read_byte(&ack))
+            {
+                detach();
+                return;
+            }
+            if (ack == '+')
+            {
+                return;
+            }
+        }
+    }
+
+    // 32bit の値をリトルエンディアンの16進数にする (レジスタの値の形式)
+    static std::string hex_u32(uint32_t v)
+    {
+        char buf[9];
+        snprintf(buf, sizeof(buf), "%02x%02x%02x%02x", v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24);
+        return buf;
+    }
+    static uint32_t parse_hex_u32(const std::string &s)
+    {
+        uint32_t v = 0;
+        for (size_t i = 0; i + 1 < s.size() && i < 8; i += 2)
+        {
+            v |= strtoul(s.substr(i, 2).c_str(), NULL, 16) << (i * 4);
+        }
+        return v;
+    }
+};
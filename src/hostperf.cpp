@@ -0,0 +1,229 @@
+// エミュレータ自身の速度の計測
+// MIPS、フェーズ (フェッチ/デコード/実行/MMU/デバイス) 毎の時間の割合、perf_event のハードウェアカウンタ
+enum HostPhase
+{
+    PHASE_OTHER,
+    PHASE_FETCH,
+    PHASE_DECODE,
+    PHASE_EXECUTE,
+    PHASE_MMU,
+    PHASE_DEVICE,
+    HOST_PHASE_NUM,
+};
+
+static const char *host_phase_names[HOST_PHASE_NUM] = {
+    "other", "fetch", "decode", "execute", "mmu", "device"};
+
+// 今どのフェーズにいるか (SIGPROF のハンドラがサンプリングする)
+// サンプリングしないときは host_phase_enabled が false で、誰も書かない
+static volatile sig_atomic_t host_phase = PHASE_OTHER;
+static bool host_phase_enabled = false;
+static volatile unsigned long long host_phase_samples[HOST_PHASE_NUM];
+
+static void host_phase_sample(int)
+{
+    host_phase_samples[host_phase]++;
+}
+
+// スコープの間だけフェーズを切り替える (入れ子になるMMU・デバイス用)
+class HostPhaseScope
+{
+    bool on;
+    sig_atomic_t saved;
+
+  public:
+    HostPhaseScope(HostPhase p) : on(host_phase_enabled), saved(PHASE_OTHER)
+    {
+        if (on)
+        {
+            saved = host_phase;
+            host_phase = p;
+        }
+    }
+    ~HostPhaseScope()
+    {
+        if (on)
+        {
+            host_phase = saved;
+        }
+    }
+};
+
+class HostPerf
+{
+    struct Counter
+    {
+        const char *name;
+        uint64_t config;
+        int fd;
+    };
+
+    std::vector<Counter> counters;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point last_time;
+    unsigned long long last_count;
+    double interval;
+    int sample_us;
+
+    static double seconds(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    void open_counters()
+    {
+        counters = {{"cycles", PERF_COUNT_HW_CPU_CYCLES, -1},
+                    {"instructions", PERF_COUNT_HW_INSTRUCTIONS, -1},
+                    {"branch-misses", PERF_COUNT_HW_BRANCH_MISSES, -1},
+                    {"cache-misses", PERF_COUNT_HW_CACHE_MISSES, -1}};
+        for (Counter &c : counters)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = c.config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            c.fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+
+  public:
+    // interval: 途中経過を出す間隔(秒, 0なら出さない)
+    // sample_us: フェーズのサンプリング間隔(マイクロ秒, 0ならサンプリングしない)
+    HostPerf(double interval, int sample_us, bool use_counters)
+    {
+        this->interval = interval;
+        this->sample_us = sample_us;
+        last_count = 0;
+        if (use_counters)
+        {
+            open_counters();
+        }
+    }
+
+    ~HostPerf()
+    {
+        for (Counter &c : counters)
+        {
+            if (c.fd >= 0)
+            {
+                close(c.fd);
+            }
+        }
+    }
+
+    void start()
+    {
+        start_time = last_time = std::chrono::steady_clock::now();
+        for (Counter &c : counters)
+        {
+            if (c.fd >= 0)
+            {
+                ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        if (sample_us > 0)
+        {
+            host_phase_enabled = true;
+            signal(SIGPROF, host_phase_sample);
+            struct itimerval it;
+            it.it_interval.tv_sec = sample_us / 1000000;
+            it.it_interval.tv_usec = sample_us % 1000000;
+            it.it_value = it.it_interval;
+            setitimer(ITIMER_PROF, &it, nullptr);
+        }
+    }
+
+    // main_loop から数百万命令に1回呼ぶ
+    void tick(unsigned long long inst_count)
+    {
+        if (interval <= 0)
+        {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double dt = seconds(now - last_time);
+        if (dt < interval)
+        {
+            return;
+        }
+        fprintf(stderr, "[hostperf] %.1fs: %llu insts, %.2f MIPS (avg %.2f MIPS)\n",
+                seconds(now - start_time), inst_count,
+                (inst_count - last_count) / dt / 1e6,
+                inst_count / seconds(now - start_time) / 1e6);
+        last_time = now;
+        last_count = inst_count;
+    }
+
+    // 計測を止めて JSON で書き出す
+    void write(const std::string &filename, unsigned long long inst_count)
+    {
+        double wall = seconds(std::chrono::steady_clock::now() - start_time);
+        if (sample_us > 0)
+        {
+            struct itimerval it = {};
+            setitimer(ITIMER_PROF, &it, nullptr);
+            signal(SIGPROF, SIG_DFL);
+        }
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        double user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        double sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+        FILE *fp = fopen(filename.c_str(), "w");
+        if (!fp)
+        {
+            error_dump("計測結果の出力先を開けませんでした: %s\n", filename.c_str());
+        }
+        fprintf(fp, "{\n");
+        fprintf(fp, "  \"instructions\": %llu,\n", inst_count);
+        fprintf(fp, "  \"wall_seconds\": %.6f,\n", wall);
+        fprintf(fp, "  \"user_seconds\": %.6f,\n", user);
+        fprintf(fp, "  \"sys_seconds\": %.6f,\n", sys);
+        fprintf(fp, "  \"mips\": %.3f,\n", wall > 0 ? inst_count / wall / 1e6 : 0);
+
+        unsigned long long total = 0;
+        for (int i = 0; i < HOST_PHASE_NUM; i++)
+        {
+            total += host_phase_samples[i];
+        }
+        fprintf(fp, "  \"phase_samples\": %llu,\n", total);
+        fprintf(fp, "  \"phases\": {");
+        for (int i = 0; i < HOST_PHASE_NUM; i++)
+        {
+            fprintf(fp, "%s\n    \"%s\": %.2f", i ? "," : "", host_phase_names[i],
+                    total ? 100.0 * host_phase_samples[i] / total : 0);
+        }
+        fprintf(fp, "\n  },\n");
+
+        fprintf(fp, "  \"counters\": {");
+        bool first = true;
+        for (Counter &c : counters)
+        {
+            fprintf(fp, "%s\n    \"%s\": ", first ? "" : ",", c.name);
+            first = false;
+            uint64_t v;
+            if (c.fd >= 0)
+            {
+                ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+            if (c.fd >= 0 && read(c.fd, &v, sizeof(v)) == sizeof(v))
+            {
+                fprintf(fp, "{\"total\": %llu, \"per_inst\": %.4f}", (unsigned long long)v,
+                        inst_count ? (double)v / inst_count : 0);
+            }
+            else
+            {
+                fprintf(fp, "null");
+            }
+        }
+        fprintf(fp, "%s}\n}\n", counters.empty() ? "" : "\n  ");
+        fclose(fp);
+        fprintf(stderr, "[hostperf] %llu insts in %.3fs: %.2f MIPS\n", inst_count, wall,
+                wall > 0 ? inst_count / wall / 1e6 : 0);
+    }
+};
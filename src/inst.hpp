@@ -17,6 +17,10 @@ enum struct Inst : uint8_t
     FSTORE = 0b0100111,
     FPU = 0b1010011,
     SYSTEM = 0b1110011,
+    FMADD = 0b1000011,
+    FMSUB = 0b1000111,
+    FNMSUB = 0b1001011,
+    FNMADD = 0b1001111,
 };
 
 enum struct Branch_Inst : uint8_t
@@ -175,4 +179,102 @@ enum struct CSR : uint16_t
     SCAUSE = 0x142,
     SIP = 0x144,
     STVAL = 0x143,
-};
\ No newline at end of file
+    CYCLE = 0xC00,
+    TIME = 0xC01,
+    INSTRET = 0xC02,
+    CYCLEH = 0xC80,
+    TIMEH = 0xC81,
+    INSTRETH = 0xC82,
+};
+
+// デコーダが振る密な命令番号 (統計の配列の添字)
+enum InstId : uint8_t
+{
+    ID_LUI,
+    ID_AUIPC,
+    ID_JAL,
+    ID_JALR,
+    ID_BEQ,
+    ID_BNE,
+    ID_BLT,
+    ID_BGE,
+    ID_BLTU,
+    ID_BGEU,
+    ID_LB,
+    ID_LH,
+    ID_LW,
+    ID_LBU,
+    ID_LHU,
+    ID_SB,
+    ID_SH,
+    ID_SW,
+    ID_ADDI,
+    ID_SLTI,
+    ID_SLTIU,
+    ID_XORI,
+    ID_ORI,
+    ID_ANDI,
+    ID_SLLI,
+    ID_SRLI,
+    ID_SRAI,
+    ID_ADD,
+    ID_SUB,
+    ID_SLL,
+    ID_SLT,
+    ID_SLTU,
+    ID_XOR,
+    ID_SRL,
+    ID_SRA,
+    ID_OR,
+    ID_AND,
+    ID_MUL,
+    ID_MULH,
+    ID_MULHSU,
+    ID_MULHU,
+    ID_DIV,
+    ID_DIVU,
+    ID_REM,
+    ID_REMU,
+    ID_FLW,
+    ID_FSW,
+    ID_FADD,
+    ID_FSUB,
+    ID_FMUL,
+    ID_FDIV,
+    ID_FSQRT,
+    ID_FMADD,
+    ID_FMSUB,
+    ID_FNMSUB,
+    ID_FNMADD,
+    ID_FSGNJ,
+    ID_FSGNJN,
+    ID_FSGNJX,
+    ID_FCVT_W_S,
+    ID_FCVT_S_W,
+    ID_FEQ,
+    ID_FLT,
+    ID_FLE,
+    ID_CSRRW,
+    ID_CSRRS,
+    ID_CSRRC,
+    ID_CSRRWI,
+    ID_CSRRSI,
+    ID_CSRRCI,
+    ID_ECALL,
+    ID_SRET,
+    ID_UNKNOWN,
+    INST_ID_NUM,
+};
+
+static const char *const inst_id_names[INST_ID_NUM] = {
+    "lui", "auipc", "jal", "jalr",
+    "beq", "bne", "blt", "bge", "bltu", "bgeu",
+    "lb", "lh", "lw", "lbu", "lhu", "sb", "sh", "sw",
+    "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+    "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+    "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    "flw", "fsw", "fadd", "fsub", "fmul", "fdiv", "fsqrt",
+    "fmadd", "fmsub", "fnmsub", "fnmadd",
+    "fsgnj", "fsgnjn", "fsgnjx", "fcvt_w_s", "fcvt_s_w", "feq", "flt", "fle",
+    "csrrw", "csrrs", "csrrc", "csrrwi", "csrrsi", "csrrci", "ecall", "sret",
+    "unknown"};
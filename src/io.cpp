@@ -3,6 +3,18 @@ class IO
     uint8_t led;
 
   public:
+    // あれば UART の受信を記録・再生する
+    InputLog *input_log;
+    // 逆実行で一度出力した所を実行し直している間は出力しない
+    bool muted;
+
+    IO() : led(0), input_log(nullptr), muted(false) {}
+
+    uint8_t read_led()
+    {
+        return led;
+    }
+
     void show_status()
     {
         printf("LED: %02x\n", led);
@@ -15,11 +27,23 @@ class IO
 
     void transmit_uart(uint8_t val)
     {
-        std::cout << val << std::flush;
+        if (!muted)
+        {
+            std::cout << val << std::flush;
+        }
     }
 
     uint8_t receive_uart()
     {
-        return getchar();
+        if (input_log && input_log->replaying())
+        {
+            return input_log->replay(INPUT_UART_RX);
+        }
+        uint8_t c = getchar();
+        if (input_log)
+        {
+            input_log->record(INPUT_UART_RX, c);
+        }
+        return c;
     }
 };
@@ -2,40 +2,121 @@
 #include <stdarg.h>
 #include <cmath>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <vector>
+#include <map>
+#include <deque>
+#include <unordered_map>
 #include <string>
 #include <bitset>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <elf.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <linux/perf_event.h>
 #include "inst.hpp"
-#include "stat.cpp"
 #include "dump.cpp"
+#include "stat.cpp"
 #include "settings.cpp"
 #include "decoder.cpp"
 #include "mtimer.cpp"
+#include "replay.cpp"
 #include "io.cpp"
+#include "cache.cpp"
+#include "hostperf.cpp"
 #include "reg_mem.cpp"
+#include "elf.cpp"
 #include "fpu.cpp"
 #include "disasm.cpp"
+#include "profiler.cpp"
+#include "callgraph.cpp"
+#include "trace.cpp"
+#include "cosim.cpp"
+#include "bpred.cpp"
+#include "pipeline.cpp"
+#include "timing.cpp"
+#include "decode_cache.cpp"
+#include "superblock.cpp"
+#include "syscall.cpp"
+#include "checkpoint.cpp"
+#include "breakpoint.cpp"
+#include "gdbstub.cpp"
 #include "core.cpp"
 
 int main(int argc, const char **argv)
 {
+    std::vector<const char *> args;
+    std::vector<std::string> long_options;
+    for (int i = 0; i < argc; i++)
+    {
+        if (i > 0 && strncmp(argv[i], "--", 2) == 0)
+        {
+            long_options.push_back(argv[i]);
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    argc = args.size();
+
     if (argc == 1)
     {
-        std::cout << "Usage: " << argv[0] << " program file" << std::endl;
+        std::cout << "Usage: " << args[0] << " program file" << std::endl;
         return 0;
     }
-    Settings s = Settings(argc == 2 ? "" : argv[2], argc <= 3 ? 0 : atoi(argv[3]), argc <= 4 ? 0 : strtol(argv[4], NULL, 16));
-    Core core((std::string(argv[1])), &s);
+    Settings s = Settings(argc == 2 ? "" : args[2], argc <= 3 ? 0 : atoi(args[3]), argc <= 4 ? 0 : strtol(args[4], NULL, 16));
+    for (const std::string &o : long_options)
+    {
+        if (!s.parse_long_option(o))
+        {
+            std::cerr << "unknown option: " << o << std::endl;
+            return -1;
+        }
+    }
+    Core *core;
     try
     {
-        core.main_loop();
+        core = new Core(std::string(args[1]), &s);
     }
     catch (int e)
     {
-        core.info();
         return -1;
     }
-    return 0;
+    int ret = 0;
+    try
+    {
+        core->main_loop();
+        ret = core->exit_code();
+    }
+    catch (int e)
+    {
+        core->info();
+        ret = -1;
+    }
+    if (!core->write_reports())
+    {
+        ret = -1;
+    }
+    delete core;
+    return ret;
 }
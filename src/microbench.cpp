@@ -0,0 +1,395 @@
+// ホットパスの関数単体のマイクロベンチマーク
+// Decoder::bit_range, Register::get_ireg, Memory::va2pa, FPU::fadd の ns/op を測る
+// 入力は実際の実行のトレースから取った分布を使う
+//   ./microbench record 入力ファイル トレース...   トレースから入力をサンプリングして書き出す
+//   ./microbench run 入力ファイル [ベースライン] [-u]   測ってベースラインと比べる (-u で書き換える)
+#include <iostream>
+#include <stdarg.h>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <elf.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <linux/perf_event.h>
+#include "inst.hpp"
+#include "dump.cpp"
+#include "decoder.cpp"
+#include "mtimer.cpp"
+#include "replay.cpp"
+#include "io.cpp"
+#include "cache.cpp"
+#include "hostperf.cpp"
+#include "reg_mem.cpp"
+#include "elf.cpp"
+#include "fpu.cpp"
+#include "disasm.cpp"
+#include "trace.cpp"
+#include "pipeline.cpp"
+
+// 種類毎に最大 sample_size 個をリザーバサンプリングで残す
+template <class T>
+class Reservoir
+{
+    static const size_t sample_size = 4096;
+
+    unsigned long long seen;
+    uint64_t rng;
+
+  public:
+    std::vector<T> items;
+
+    Reservoir() : seen(0), rng(0x2017) {}
+
+    void add(const T &x)
+    {
+        seen++;
+        if (items.size() < sample_size)
+        {
+            items.push_back(x);
+            return;
+        }
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned long long j = (rng >> 11) % seen;
+        if (j < sample_size)
+        {
+            items[j] = x;
+        }
+    }
+};
+
+class MicroBench
+{
+    static const size_t ops_per_run = 1 << 24;
+    static const int runs = 5;
+
+    std::vector<uint32_t> codes;
+    std::vector<int> iregs;
+    std::vector<uint32_t> vaddrs;
+    std::vector<std::pair<uint32_t, uint32_t>> fadds;
+
+    Memory *memory;
+    volatile uint64_t sink;
+
+    // runs回測って一番速いものの ns/op
+    template <class F>
+    double measure(size_t n, F body)
+    {
+        double best = 1e30;
+        for (int r = 0; r < runs; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t acc = 0;
+            size_t done = 0;
+            while (done < ops_per_run)
+            {
+                acc += body();
+                done += n;
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            sink = acc;
+            // n が ops_per_run を割り切らなくても、実際に実行した回数で割る
+            best = std::min(best, ns / done);
+        }
+        return best;
+    }
+
+    // 入力に出てくるページを恒等写像する2段のページテーブルを作る
+    void setup_page_table()
+    {
+        const uint32_t root = 0x7f000000;
+        uint32_t next_table = root + 0x1000;
+        uint32_t *m = (uint32_t *)memory->memory;
+        for (uint32_t va : vaddrs)
+        {
+            uint32_t &l1 = m[(root + (va >> 22) * 4) / 4];
+            if (!(l1 & 1))
+            {
+                l1 = ((next_table >> 12) << 10) | 1;
+                next_table += 0x1000;
+            }
+            uint32_t table = (l1 >> 10) << 12;
+            // ppn1 は物理アドレス [33:22]、ppn0 は [21:12] (DAGUXWRV = 0b00011111)
+            m[(table + ((va >> 12) & 0x3ff) * 4) / 4] = ((va >> 12) << 10) | 0x1f;
+        }
+        memory->write_satp((1u << 31) | (root >> 12));
+    }
+
+  public:
+    MicroBench()
+    {
+        memory = nullptr;
+        sink = 0;
+    }
+    ~MicroBench()
+    {
+        delete memory;
+    }
+
+    void record(const std::string &out, const std::vector<std::string> &traces)
+    {
+        Reservoir<uint32_t> code_sample, vaddr_sample;
+        Reservoir<int> ireg_sample;
+        Reservoir<std::pair<uint32_t, uint32_t>> fadd_sample;
+        for (const std::string &file : traces)
+        {
+            TraceReader reader(file);
+            std::vector<TraceRecord> buf(4096);
+            uint32_t fregs[32] = {0};
+            size_t got;
+            while ((got = reader.read(buf.data(), buf.size())) > 0)
+            {
+                for (size_t i = 0; i < got; i++)
+                {
+                    const TraceRecord &rec = buf[i];
+                    if (rec.flags & TRACE_TRAP)
+                    {
+                        continue;
+                    }
+                    Decoder d(rec.inst);
+                    code_sample.add(rec.inst);
+                    PipeInst p = pipe_inst(&d);
+                    for (uint8_t s : p.src)
+                    {
+                        if (s < 32)
+                        {
+                            ireg_sample.add(s);
+                        }
+                    }
+                    if (p.dest < 32)
+                    {
+                        ireg_sample.add(p.dest);
+                    }
+                    if (rec.flags & (TRACE_MEM_READ | TRACE_MEM_WRITE))
+                    {
+                        vaddr_sample.add(rec.addr);
+                    }
+                    // 書き戻しを追って浮動小数点レジスタの値を再現する
+                    InstId id = d.inst_id();
+                    if (id == ID_FADD || id == ID_FSUB)
+                    {
+                        fadd_sample.add(std::make_pair(fregs[d.rs1()], fregs[d.rs2()] ^ (id == ID_FSUB ? 0x80000000 : 0)));
+                    }
+                    if (rec.rd >= 32 && rec.rd < 64)
+                    {
+                        fregs[rec.rd - 32] = rec.wb;
+                    }
+                }
+            }
+        }
+        FILE *fp = fopen(out.c_str(), "w");
+        if (!fp)
+        {
+            error_dump("出力先を開けませんでした: %s\n", out.c_str());
+        }
+        fprintf(fp, "# microbench inputs (./microbench record で作る)\n");
+        for (uint32_t c : code_sample.items)
+        {
+            fprintf(fp, "decode %08x\n", c);
+        }
+        for (int r : ireg_sample.items)
+        {
+            fprintf(fp, "ireg %d\n", r);
+        }
+        for (uint32_t a : vaddr_sample.items)
+        {
+            fprintf(fp, "vaddr %08x\n", a);
+        }
+        for (auto &f : fadd_sample.items)
+        {
+            fprintf(fp, "fadd %08x %08x\n", f.first, f.second);
+        }
+        fclose(fp);
+    }
+
+    void load(const std::string &file)
+    {
+        std::ifstream ifs(file);
+        if (!ifs)
+        {
+            error_dump("入力を開けませんでした: %s\n", file.c_str());
+        }
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            char kind[16];
+            unsigned a = 0, b = 0;
+            if (sscanf(line.c_str(), "%15s %x %x", kind, &a, &b) < 2 || kind[0] == '#')
+            {
+                continue;
+            }
+            std::string k = kind;
+            if (k == "decode")
+            {
+                codes.push_back(a);
+            }
+            else if (k == "ireg")
+            {
+                iregs.push_back(strtol(line.c_str() + 5, NULL, 10));
+            }
+            else if (k == "vaddr")
+            {
+                vaddrs.push_back(a);
+            }
+            else if (k == "fadd")
+            {
+                fadds.push_back(std::make_pair(a, b));
+            }
+        }
+        if (codes.empty() || iregs.empty() || vaddrs.empty() || fadds.empty())
+        {
+            error_dump("入力に足りない種類があります: %s\n", file.c_str());
+        }
+    }
+
+    // 名前と ns/op
+    std::vector<std::pair<std::string, double>> run()
+    {
+        std::vector<std::pair<std::string, double>> result;
+
+        // 1命令のデコードで使うフィールドを全部取り出す
+        Decoder dec(0);
+        double ns = measure(codes.size() * 6, [&]() {
+            uint64_t acc = 0;
+            for (uint32_t c : codes)
+            {
+                acc += dec.bit_range(c, 7, 1) + dec.bit_range(c, 12, 8) + dec.bit_range(c, 15, 13) +
+                       dec.bit_range(c, 20, 16) + dec.bit_range(c, 25, 21) + dec.bit_range(c, 32, 26);
+            }
+            return acc;
+        });
+        result.push_back(std::make_pair("Decoder::bit_range", ns));
+
+        Register reg;
+        for (int i = 1; i < 32; i++)
+        {
+            reg.set_ireg(i, i * 0x01010101);
+        }
+        ns = measure(iregs.size(), [&]() {
+            uint64_t acc = 0;
+            for (int r : iregs)
+            {
+                acc += reg.get_ireg(r);
+            }
+            return acc;
+        });
+        result.push_back(std::make_pair("Register::get_ireg", ns));
+
+        memory = new Memory(new IO, new MTIMER);
+        setup_page_table();
+        Permission perm = Permission().read_on();
+        ns = measure(vaddrs.size(), [&]() {
+            uint64_t acc = 0;
+            for (uint32_t va : vaddrs)
+            {
+                acc += memory->va2pa(va, perm);
+            }
+            return acc;
+        });
+        result.push_back(std::make_pair("Memory::va2pa", ns));
+
+        ns = measure(fadds.size(), [&]() {
+            uint64_t acc = 0;
+            for (auto &f : fadds)
+            {
+                acc += FPU::fadd(f.first, f.second);
+            }
+            return acc;
+        });
+        result.push_back(std::make_pair("FPU::fadd", ns));
+        return result;
+    }
+};
+
+int main(int argc, const char **argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " record inputs trace..." << std::endl;
+        std::cout << "       " << argv[0] << " run inputs [baseline] [-u]" << std::endl;
+        return 0;
+    }
+    std::string mode = argv[1];
+    try
+    {
+        MicroBench bench;
+        if (mode == "record")
+        {
+            bench.record(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+            return 0;
+        }
+        bench.load(argv[2]);
+        std::string baseline_file = argc > 3 ? argv[3] : "";
+        bool update = argc > 4 && std::string(argv[4]) == "-u";
+        double threshold = getenv("THRESHOLD") ? atof(getenv("THRESHOLD")) : 10;
+
+        std::map<std::string, double> baseline;
+        std::ifstream ifs(baseline_file);
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            char name[64];
+            double v;
+            if (line[0] != '#' && sscanf(line.c_str(), "%63s %lf", name, &v) == 2)
+            {
+                baseline[name] = v;
+            }
+        }
+
+        int status = 0;
+        auto result = bench.run();
+        printf("%-28s %10s %10s %8s\n", "function", "ns/op", "baseline", "diff");
+        for (auto &r : result)
+        {
+            if (baseline.count(r.first) == 0)
+            {
+                printf("%-28s %10.3f %10s %8s\n", r.first.c_str(), r.second, "-", "-");
+                continue;
+            }
+            double b = baseline[r.first];
+            printf("%-28s %10.3f %10.3f %+7.1f%%\n", r.first.c_str(), r.second, b, (r.second / b - 1) * 100);
+            if (!update && r.second > b * (1 + threshold / 100))
+            {
+                printf("  %s: %.0f%% を超えて遅くなりました\n", r.first.c_str(), threshold);
+                status = 1;
+            }
+        }
+        if (update && baseline_file != "")
+        {
+            FILE *fp = fopen(baseline_file.c_str(), "w");
+            if (!fp)
+            {
+                error_dump("ベースラインを書き込めませんでした: %s\n", baseline_file.c_str());
+            }
+            fprintf(fp, "# function ns/op (make micro-update で更新)\n");
+            for (auto &r : result)
+            {
+                fprintf(fp, "%s %.3f\n", r.first.c_str(), r.second);
+            }
+            fclose(fp);
+            printf("%s を更新しました\n", baseline_file.c_str());
+        }
+        return status;
+    }
+    catch (int e)
+    {
+        return -1;
+    }
+}
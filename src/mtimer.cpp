@@ -10,6 +10,21 @@ class MTIMER
         mtimecmp = 0;
     }
 
+    // チェックポイントへの保存と復元
+    uint64_t get_mtime()
+    {
+        return mtime;
+    }
+    uint64_t get_mtimecmp()
+    {
+        return mtimecmp;
+    }
+    void restore(uint64_t time, uint64_t cmp)
+    {
+        mtime = time;
+        mtimecmp = cmp;
+    }
+
     void incr_time(uint64_t tm)
     {
         mtime += tm;
@@ -0,0 +1,364 @@
+// 5段インオーダーパイプラインのサイクル数の見積もり
+// 命令クラス毎のレイテンシ表から、データハザード(ロードユース含む)・
+// FPUの構造ハザード・分岐ペナルティによるストールを数える
+enum PipeClass : uint8_t
+{
+    PIPE_ALU,
+    PIPE_MUL,
+    PIPE_DIV,
+    PIPE_LOAD,
+    PIPE_STORE,
+    PIPE_BRANCH,
+    PIPE_JUMP,
+    PIPE_FADD,
+    PIPE_FMUL,
+    PIPE_FMA,
+    PIPE_FDIV,
+    PIPE_FSQRT,
+    PIPE_FMISC,
+    PIPE_SYSTEM,
+    PIPE_CLASS_NUM,
+};
+
+static const char *pipe_class_names[PIPE_CLASS_NUM] = {
+    "alu", "mul", "div", "load", "store", "branch", "jump",
+    "fadd", "fmul", "fma", "fdiv", "fsqrt", "fmisc", "system"};
+
+// 演算器 (同じ演算器を使う命令は occupancy の間発行できない)
+enum PipeUnit : uint8_t
+{
+    UNIT_INT,
+    UNIT_MULDIV,
+    UNIT_MEM,
+    UNIT_FPU,
+    UNIT_NUM,
+};
+
+static const uint8_t pipe_no_reg = 0xff;
+
+struct PipeInst
+{
+    PipeClass cls;
+    PipeUnit unit;
+    uint8_t src[3]; // 0-31 整数, 32-63 浮動小数点
+    uint8_t dest;
+};
+
+PipeInst pipe_inst(Decoder *d)
+{
+    PipeInst p;
+    p.cls = PIPE_ALU;
+    p.unit = UNIT_INT;
+    p.src[0] = p.src[1] = p.src[2] = pipe_no_reg;
+    p.dest = trace_dest(d);
+    uint8_t rs1 = d->rs1(), rs2 = d->rs2(), rs3 = d->rs3();
+    switch (static_cast<Inst>(d->opcode()))
+    {
+    case Inst::LUI:
+    case Inst::AUIPC:
+        break;
+    case Inst::JAL:
+        p.cls = PIPE_JUMP;
+        break;
+    case Inst::JALR:
+        p.cls = PIPE_JUMP;
+        p.src[0] = rs1;
+        break;
+    case Inst::BRANCH:
+        p.cls = PIPE_BRANCH;
+        p.src[0] = rs1;
+        p.src[1] = rs2;
+        break;
+    case Inst::LOAD:
+        p.cls = PIPE_LOAD;
+        p.unit = UNIT_MEM;
+        p.src[0] = rs1;
+        break;
+    case Inst::STORE:
+        p.cls = PIPE_STORE;
+        p.unit = UNIT_MEM;
+        p.src[0] = rs1;
+        p.src[1] = rs2;
+        break;
+    case Inst::ALUI:
+        p.src[0] = rs1;
+        break;
+    case Inst::ALU:
+        p.src[0] = rs1;
+        p.src[1] = rs2;
+        if (d->funct7() == 1)
+        {
+            p.unit = UNIT_MULDIV;
+            p.cls = d->funct3() >= static_cast<uint8_t>(Mul_Div_Inst::DIV) ? PIPE_DIV : PIPE_MUL;
+        }
+        break;
+    case Inst::FLOAD:
+        p.cls = PIPE_LOAD;
+        p.unit = UNIT_MEM;
+        p.src[0] = rs1;
+        break;
+    case Inst::FSTORE:
+        p.cls = PIPE_STORE;
+        p.unit = UNIT_MEM;
+        p.src[0] = rs1;
+        p.src[1] = 32 + rs2;
+        break;
+    case Inst::FMADD:
+    case Inst::FMSUB:
+    case Inst::FNMSUB:
+    case Inst::FNMADD:
+        p.cls = PIPE_FMA;
+        p.unit = UNIT_FPU;
+        p.src[0] = 32 + rs1;
+        p.src[1] = 32 + rs2;
+        p.src[2] = 32 + rs3;
+        break;
+    case Inst::FPU:
+        p.unit = UNIT_FPU;
+        p.cls = PIPE_FMISC;
+        p.src[0] = 32 + rs1;
+        p.src[1] = 32 + rs2;
+        switch (static_cast<FPU_Inst>(d->funct5_fmt()))
+        {
+        case FPU_Inst::FADD:
+        case FPU_Inst::FSUB:
+            p.cls = PIPE_FADD;
+            break;
+        case FPU_Inst::FMUL:
+            p.cls = PIPE_FMUL;
+            break;
+        case FPU_Inst::FDIV:
+            p.cls = PIPE_FDIV;
+            break;
+        case FPU_Inst::FSQRT:
+            p.cls = PIPE_FSQRT;
+            p.src[1] = pipe_no_reg;
+            break;
+        case FPU_Inst::FCVT_W_S:
+        case FPU_Inst::FMV_X_W:
+            p.src[1] = pipe_no_reg;
+            break;
+        case FPU_Inst::FCVT_S_W:
+        case FPU_Inst::FMV_W_X:
+            p.src[0] = rs1;
+            p.src[1] = pipe_no_reg;
+            break;
+        default:
+            break;
+        }
+        break;
+    case Inst::SYSTEM:
+        p.cls = PIPE_SYSTEM;
+        if (d->funct3() <= static_cast<uint8_t>(System_Inst::CSRRC))
+        {
+            p.src[0] = rs1;
+        }
+        break;
+    default:
+        break;
+    }
+    // x0 は待たない
+    for (int i = 0; i < 3; i++)
+    {
+        if (p.src[i] == 0)
+        {
+            p.src[i] = pipe_no_reg;
+        }
+    }
+    if (p.dest == 0)
+    {
+        p.dest = pipe_no_reg;
+    }
+    return p;
+}
+
+class Pipeline
+{
+    struct FuncStat
+    {
+        uint64_t insts;
+        uint64_t cycles;
+    };
+
+    // latency: 結果が後続命令で使えるようになるまでのサイクル数
+    // occupancy: 演算器が次の命令を受け付けるまでのサイクル数 (パイプライン化されていなければ latency と同じ)
+    uint32_t latency[PIPE_CLASS_NUM];
+    uint32_t occupancy[PIPE_CLASS_NUM];
+    uint32_t redirect_penalty; // 分岐成立・ジャンプで捨てる段数
+    double freq_mhz;
+
+    uint64_t cycle; // 直前の命令を発行したサイクル
+    uint64_t insts;
+    uint64_t reg_ready[64];
+    bool reg_from_load[64];
+    uint64_t unit_free[UNIT_NUM];
+
+    uint64_t load_use_stalls;
+    uint64_t data_stalls;
+    uint64_t structural_stalls;
+    uint64_t branch_stalls;
+    uint64_t class_count[PIPE_CLASS_NUM];
+    std::unordered_map<uint32_t, FuncStat> funcs;
+
+    bool pending_redirect;
+
+    void set_defaults()
+    {
+        uint32_t lat[PIPE_CLASS_NUM] = {1, 3, 34, 2, 1, 1, 1, 4, 4, 5, 16, 16, 2, 1};
+        uint32_t occ[PIPE_CLASS_NUM] = {1, 1, 34, 1, 1, 1, 1, 1, 1, 1, 16, 16, 1, 1};
+        for (int i = 0; i < PIPE_CLASS_NUM; i++)
+        {
+            latency[i] = lat[i];
+            occupancy[i] = occ[i];
+        }
+        redirect_penalty = 2;
+    }
+
+  public:
+    // あれば関数をシンボルの名前で出す
+    SymbolTable *symbols;
+
+    // FILE の各行は "class latency [occupancy]"、分岐ペナルティは "redirect N"
+    Pipeline(const std::string &filename, double freq_mhz)
+    {
+        symbols = nullptr;
+        set_defaults();
+        this->freq_mhz = freq_mhz;
+        if (filename != "")
+        {
+            std::ifstream ifs(filename);
+            if (!ifs)
+            {
+                error_dump("レイテンシ表を開けませんでした: %s\n", filename.c_str());
+            }
+            std::string line;
+            while (std::getline(ifs, line))
+            {
+                char name[32];
+                unsigned lat, occ;
+                int n = sscanf(line.c_str(), "%31s %u %u", name, &lat, &occ);
+                if (n < 2 || name[0] == '#')
+                {
+                    continue;
+                }
+                if (std::string(name) == "redirect")
+                {
+                    redirect_penalty = lat;
+                    continue;
+                }
+                int c = 0;
+                while (c < PIPE_CLASS_NUM && std::string(name) != pipe_class_names[c])
+                {
+                    c++;
+                }
+                if (c == PIPE_CLASS_NUM)
+                {
+                    error_dump("知らない命令クラスです: %s\n", name);
+                }
+                latency[c] = lat == 0 ? 1 : lat;
+                occupancy[c] = n >= 3 ? (occ == 0 ? 1 : occ) : 1;
+            }
+        }
+        cycle = 0;
+        insts = 0;
+        for (int i = 0; i < 64; i++)
+        {
+            reg_ready[i] = 0;
+            reg_from_load[i] = false;
+        }
+        for (int i = 0; i < UNIT_NUM; i++)
+        {
+            unit_free[i] = 0;
+        }
+        for (int i = 0; i < PIPE_CLASS_NUM; i++)
+        {
+            class_count[i] = 0;
+        }
+        load_use_stalls = data_stalls = structural_stalls = branch_stalls = 0;
+        pending_redirect = false;
+    }
+
+    // 1命令リタイア。redirect は次の命令がip+4でないとき
+    void retire(const PipeInst &p, bool redirect, uint32_t func)
+    {
+        uint64_t issue = cycle + 1;
+        if (pending_redirect)
+        {
+            issue += redirect_penalty;
+            branch_stalls += redirect_penalty;
+        }
+        uint64_t ready = issue;
+        bool from_load = false;
+        for (int i = 0; i < 3; i++)
+        {
+            if (p.src[i] != pipe_no_reg && reg_ready[p.src[i]] > ready)
+            {
+                ready = reg_ready[p.src[i]];
+                from_load = reg_from_load[p.src[i]];
+            }
+        }
+        if (ready > issue)
+        {
+            (from_load ? load_use_stalls : data_stalls) += ready - issue;
+            issue = ready;
+        }
+        if (unit_free[p.unit] > issue)
+        {
+            structural_stalls += unit_free[p.unit] - issue;
+            issue = unit_free[p.unit];
+        }
+        unit_free[p.unit] = issue + occupancy[p.cls];
+        if (p.dest != pipe_no_reg)
+        {
+            reg_ready[p.dest] = issue + latency[p.cls];
+            reg_from_load[p.dest] = p.cls == PIPE_LOAD;
+        }
+
+        FuncStat &f = funcs[func];
+        f.insts++;
+        f.cycles += issue - cycle;
+        cycle = issue;
+        insts++;
+        class_count[p.cls]++;
+        pending_redirect = redirect;
+    }
+
+    void write(const std::string &filename, size_t top)
+    {
+        FILE *fp = fopen(filename.c_str(), "w");
+        if (fp == nullptr)
+        {
+            warn_dump("%s を開けませんでした\n", filename.c_str());
+            return;
+        }
+        // 最初の命令がパイプラインを抜けるまでの4サイクルを足す
+        uint64_t total = insts == 0 ? 0 : cycle + 4;
+        fprintf(fp, "# instructions %llu, cycles %llu, CPI %.4f\n", (unsigned long long)insts,
+                (unsigned long long)total, insts == 0 ? 0.0 : (double)total / insts);
+        fprintf(fp, "# estimated time at %.1f MHz: %.6f s\n", freq_mhz, total / (freq_mhz * 1e6));
+        fprintf(fp, "stalls: load-use %llu, data %llu, structural %llu, branch %llu\n",
+                (unsigned long long)load_use_stalls, (unsigned long long)data_stalls,
+                (unsigned long long)structural_stalls, (unsigned long long)branch_stalls);
+        fprintf(fp, "\n# class    count  latency  occupancy\n");
+        for (int i = 0; i < PIPE_CLASS_NUM; i++)
+        {
+            fprintf(fp, "%-7s %12llu %4u %4u\n", pipe_class_names[i], (unsigned long long)class_count[i], latency[i], occupancy[i]);
+        }
+        fprintf(fp, "redirect %u\n", redirect_penalty);
+
+        std::vector<std::pair<uint32_t, FuncStat>> fs(funcs.begin(), funcs.end());
+        std::sort(fs.begin(), fs.end(), [](const std::pair<uint32_t, FuncStat> &a, const std::pair<uint32_t, FuncStat> &b) {
+            return a.second.cycles == b.second.cycles ? a.first < b.first : a.second.cycles > b.second.cycles;
+        });
+        // cycle% は先頭の cycles (最初の4サイクルを含む) に対する割合
+        fprintf(fp, "\n#     func        insts       cycles     CPI   cycle%%  symbol\n");
+        for (size_t i = 0; i < fs.size() && i < top; i++)
+        {
+            const FuncStat &f = fs[i].second;
+            fprintf(fp, "0x%08x %12llu %12llu %7.3f %8.3f  %s\n", fs[i].first, (unsigned long long)f.insts,
+                    (unsigned long long)f.cycles, (double)f.cycles / f.insts, total == 0 ? 0.0 : 100.0 * f.cycles / total,
+                    symbols ? symbols->describe(fs[i].first).c_str() : "");
+        }
+        fclose(fp);
+    }
+};
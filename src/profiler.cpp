@@ -0,0 +1,121 @@
+// PC毎の実行回数を数えるプロファイラ
+// interval > 1 の場合は interval 命令に1回だけサンプリングする
+class Profiler
+{
+    static const uint32_t page_shift = 12;
+    static const uint32_t page_num = 1 << (32 - page_shift);
+    static const uint32_t slot_num = 1 << (page_shift - 2);
+
+    // 4KiB のコード領域ごとにカウンタを遅延確保する
+    std::vector<uint64_t *> pages;
+    uint64_t interval;
+    uint64_t countdown;
+    uint64_t samples;
+
+    struct Entry
+    {
+        uint32_t addr;
+        uint64_t count;
+    };
+
+    std::vector<Entry> entries()
+    {
+        std::vector<Entry> ret;
+        for (uint32_t p = 0; p < page_num; p++)
+        {
+            if (pages[p] == nullptr)
+            {
+                continue;
+            }
+            for (uint32_t i = 0; i < slot_num; i++)
+            {
+                if (pages[p][i] != 0)
+                {
+                    ret.push_back({(p << page_shift) | (i << 2), pages[p][i]});
+                }
+            }
+        }
+        return ret;
+    }
+
+  public:
+    // あればアドレスの横にシンボルを出す
+    SymbolTable *symbols;
+    // 逆実行で一度数えた所を実行し直している間は数えない
+    bool muted;
+
+    Profiler(uint64_t interval) : pages(page_num, nullptr)
+    {
+        symbols = nullptr;
+        muted = false;
+        this->interval = interval == 0 ? 1 : interval;
+        countdown = this->interval;
+        samples = 0;
+    }
+    ~Profiler()
+    {
+        for (uint64_t *p : pages)
+        {
+            delete[] p;
+        }
+    }
+
+    void hit(uint32_t ip)
+    {
+        if (muted || --countdown != 0)
+        {
+            return;
+        }
+        countdown = interval;
+        uint64_t *&p = pages[ip >> page_shift];
+        if (p == nullptr)
+        {
+            p = new uint64_t[slot_num]();
+        }
+        p[(ip >> 2) & (slot_num - 1)]++;
+        samples++;
+    }
+
+    // prefix.hot: 実行回数の多い順 / prefix.raw: アドレス順の生データ
+    void write(const std::string &prefix, size_t top)
+    {
+        std::vector<Entry> es = entries();
+
+        FILE *raw = fopen((prefix + ".raw").c_str(), "w");
+        if (raw == nullptr)
+        {
+            warn_dump("%s.raw を開けませんでした\n", prefix.c_str());
+            return;
+        }
+        fprintf(raw, "# interval %llu\n", (unsigned long long)interval);
+        for (const Entry &e : es)
+        {
+            fprintf(raw, "%08x %llu\n", e.addr, (unsigned long long)e.count);
+        }
+        fclose(raw);
+
+        std::sort(es.begin(), es.end(), [](const Entry &a, const Entry &b) {
+            return a.count == b.count ? a.addr < b.addr : a.count > b.count;
+        });
+        FILE *hot = fopen((prefix + ".hot").c_str(), "w");
+        if (hot == nullptr)
+        {
+            warn_dump("%s.hot を開けませんでした\n", prefix.c_str());
+            return;
+        }
+        fprintf(hot, "# samples: %llu (interval %llu)\n", (unsigned long long)samples, (unsigned long long)interval);
+        fprintf(hot, "# rank     addr        count       %%   cumul%%  symbol\n");
+        uint64_t cumul = 0;
+        // 1回もサンプルしていなければ割合は 0 にする (nan を出さない)
+        double scale = samples == 0 ? 0.0 : 100.0 / samples;
+        for (size_t i = 0; i < es.size() && i < top; i++)
+        {
+            cumul += es[i].count;
+            fprintf(hot, "%6zu %08x %12llu %7.3f %7.3f  %s\n", i + 1, es[i].addr,
+                    (unsigned long long)es[i].count,
+                    scale * es[i].count, scale * cumul,
+                    symbols ? symbols->describe(es[i].addr).c_str() : "");
+        }
+        fclose(hot);
+    }
+};
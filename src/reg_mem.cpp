@@ -59,8 +59,36 @@ class Permission
     }
 };
 
+// 物理ページ毎のフラグ
+enum PageFlag : uint8_t
+{
+    PAGE_CODE = 1 << 0,     // スーパーブロックの命令がある
+    PAGE_SNAPSHOT = 1 << 1, // 最後のチェックポイントから書き込まれていない
+    PAGE_CLEAN = 1 << 2,    // 書き込みを記録していて、まだ書き込まれていない
+    PAGE_WATCH = 1 << 3,    // ウォッチポイントの範囲がある
+};
+
+// 物理アドレスの範囲へのアクセスで止まるウォッチポイント
+struct Watchpoint
+{
+    uint32_t start; // 物理アドレス
+    uint32_t len;
+    bool read;
+    bool write;
+    uint32_t vaddr; // 指定されたアドレス (当たったときに返す)
+};
+
+// チェックポイントの後で初めて書き込まれたページの、書き込む前の中身
+struct SavedPage
+{
+    uint32_t page;
+    std::vector<uint8_t> data;
+};
+
 class Memory
 {
+    friend class MicroBench;
+
     static const uint32_t memory_size = 1 << 31;
 
     static const uint32_t uart_rx_addr = 0x80000000;
@@ -74,7 +102,16 @@ class Memory
     static const uint32_t PTESIZE = 4;
     static const uint32_t LEVELS = 2;
 
-    uint8_t memory[memory_size];
+    // 物理メモリ (ページ境界に揃えて確保して、ファイルを直接貼れるようにする)
+    uint8_t *memory;
+    // 4KiBページ毎のフラグ (32bitの物理アドレス空間全体)
+    std::vector<uint8_t> page_flags;
+    // 書き込まれたページ (1bit/ページ、記録していなければ空)
+    // 記録中はまだ書き込まれていないページに PAGE_CLEAN を立てておき、最初の書き込みだけで印を付ける
+    std::vector<uint64_t> dirty;
+    std::vector<Watchpoint> watchpoints;
+    // 読み込みのウォッチポイントがあるときだけ読み込みでもページのフラグを見る
+    bool watch_reads;
     IO *io;
     MTIMER *mtimer;
     Permission perm;
@@ -162,6 +199,7 @@ class Memory
 
     uint64_t va2pa(uint32_t addr, Permission perm)
     {
+        HostPhaseScope phase(PHASE_MMU);
         //printf("va2pa: %x\n", addr);
         //printf("%x\n", satp);
         int32_t i = LEVELS - 1;
@@ -246,6 +284,50 @@ class Memory
         return pa;
     }
 
+    // フラグの立っているページへの書き込み
+    void flagged_write(uint32_t pa, uint32_t size)
+    {
+        uint32_t page = pa >> 12;
+        if (page_flags[page] & PAGE_CODE)
+        {
+            code_gen++;
+        }
+        if (page_flags[page] & PAGE_SNAPSHOT)
+        {
+            page_flags[page] &= ~PAGE_SNAPSHOT;
+            const uint8_t *p = memory + (uint64_t)page * PGSIZE;
+            saved_pages->push_back({page, std::vector<uint8_t>(p, p + PGSIZE)});
+        }
+        if (page_flags[page] & PAGE_CLEAN)
+        {
+            mark_dirty(page);
+        }
+        if (page_flags[page] & PAGE_WATCH)
+        {
+            check_watch(pa, size, true);
+        }
+    }
+
+    void check_watch(uint32_t pa, uint32_t size, bool write)
+    {
+        for (const Watchpoint &w : watchpoints)
+        {
+            if ((write ? w.write : w.read) && pa < (uint64_t)w.start + w.len && w.start < (uint64_t)pa + size)
+            {
+                watch_hit = true;
+                watch_addr = w.vaddr + (pa > w.start ? pa - w.start : 0);
+                watch_write = write;
+                watch_access = w.read && w.write;
+            }
+        }
+    }
+
+    void mark_dirty(uint32_t page)
+    {
+        page_flags[page] &= ~PAGE_CLEAN;
+        dirty[page / 64] |= 1ull << (page % 64);
+    }
+
     void alignment_check(uint32_t addr, uint8_t size)
     {
         if (addr % size != 0)
@@ -270,10 +352,14 @@ class Memory
         }
         else if (addr == uart_tx_addr)
         {
+            HostPhaseScope phase(PHASE_DEVICE);
+            mtimer->incr_time(uart_time);
             io->transmit_uart(val);
         }
         else if (addr == led_addr)
         {
+            HostPhaseScope phase(PHASE_DEVICE);
+            mtimer->incr_time(led_time);
             io->write_led(val);
         }
         else
@@ -287,6 +373,8 @@ class Memory
     {
         if (addr == uart_rx_addr)
         {
+            HostPhaseScope phase(PHASE_DEVICE);
+            mtimer->incr_time(uart_time);
             *v = io->receive_uart();
         }
         else if (addr == uart_tx_addr)
@@ -306,6 +394,11 @@ class Memory
 
     bool hook_mtimer_write(uint32_t addr, uint32_t val)
     {
+        if (!is_mtimer_addr(addr))
+        {
+            return false;
+        }
+        HostPhaseScope phase(PHASE_DEVICE);
         if (addr == mtime_addr)
         {
             mtimer->write_mtimel(val);
@@ -326,11 +419,17 @@ class Memory
         {
             return false;
         }
+        mtimer->incr_time(mtimer_time);
         return true;
     }
 
     bool hook_mtimer_read(uint32_t addr, uint32_t *v)
     {
+        if (!is_mtimer_addr(addr))
+        {
+            return false;
+        }
+        HostPhaseScope phase(PHASE_DEVICE);
         if (addr == mtime_addr)
         {
             *v = mtimer->read_mtimel();
@@ -351,9 +450,30 @@ class Memory
         {
             return false;
         }
+        mtimer->incr_time(mtimer_time);
         return true;
     }
 
+    void cache_load(uint32_t pa)
+    {
+        if (cache)
+        {
+            uint32_t t = cache->load(pa);
+            if (cache_timing)
+                mtimer->incr_time(t);
+        }
+    }
+
+    void cache_store(uint32_t pa)
+    {
+        if (cache)
+        {
+            uint32_t t = cache->store(pa);
+            if (cache_timing)
+                mtimer->incr_time(t);
+        }
+    }
+
     uint64_t mmu(uint32_t addr, Permission perm)
     {
         if (!is_addressing_on())
@@ -364,15 +484,241 @@ class Memory
     }
 
   public:
-    Memory(IO *io, MTIMER *mtimer)
+    // 最後にアクセスした仮想アドレスと書き込んだ値 (トレース用)
+    uint32_t last_vaddr;
+    uint32_t last_wdata;
+
+    // nullptrでなければキャッシュシミュレータにアクセスを流す
+    // cache_timing なら求めたレイテンシで mtime を進める
+    CacheSim *cache;
+    bool cache_timing;
+
+    // MMIOデバイスへのアクセス1回で進める仮想時間
+    uint32_t uart_time;
+    uint32_t led_time;
+    uint32_t mtimer_time;
+
+    // PAGE_CODE のページに書き込む度に増える (スーパーブロックが古くなったかの判定用)
+    uint64_t code_gen;
+    // PAGE_SNAPSHOT のページに書き込む前の中身を残す先
+    std::vector<SavedPage> *saved_pages;
+    // ウォッチポイントに当たったら立てる (下ろすのは呼び出し側)
+    // watch_addr は指定されたアドレスの側で数えたアクセスのアドレス
+    bool watch_hit;
+    uint32_t watch_addr;
+    bool watch_write;
+    bool watch_access; // 読み書きどちらでも当たるもの
+
+    Memory(IO *io, MTIMER *mtimer) : page_flags(1 << 20)
     {
         this->io = io;
         this->mtimer = mtimer;
+        last_vaddr = 0;
+        last_wdata = 0;
+        cache = nullptr;
+        cache_timing = false;
+        uart_time = 0;
+        led_time = 0;
+        mtimer_time = 0;
+        code_gen = 0;
+        saved_pages = nullptr;
+        watch_reads = false;
+        watch_hit = false;
+        watch_addr = 0;
+        watch_write = false;
+        watch_access = false;
+        void *p = ::mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            error_dump("メモリを確保できませんでした\n");
+        }
+        memory = (uint8_t *)p;
+    }
+    ~Memory()
+    {
+        munmap(memory, memory_size);
+    }
+
+    // 仮想アドレスを物理アドレスに変換する (ページフォルトは例外)
+    uint64_t translate(uint32_t addr, Permission perm)
+    {
+        return mmu(addr, perm);
+    }
+
+    void set_page_flag(uint64_t pa, uint8_t flag)
+    {
+        page_flags[pa >> 12] |= flag;
+    }
+
+    // 次に書き込まれたら中身を saved_pages に残すようにする (MMIO の領域は除く)
+    void snapshot_page(uint32_t page)
+    {
+        page_flags[page] |= PAGE_SNAPSHOT;
+    }
+    void snapshot_all_pages()
+    {
+        for (uint32_t page = 0; page < memory_size / PGSIZE; page++)
+        {
+            page_flags[page] |= PAGE_SNAPSHOT;
+        }
+    }
+    // saved_pages に残した中身を書き戻す
+    void restore_page(const SavedPage &s)
+    {
+        memcpy(memory + (uint64_t)s.page * PGSIZE, s.data.data(), PGSIZE);
+        code_gen++;
+        if (page_flags[s.page] & PAGE_CLEAN)
+        {
+            mark_dirty(s.page);
+        }
+    }
+
+    void add_watchpoint(const Watchpoint &w)
+    {
+        watchpoints.push_back(w);
+        for (uint64_t page = w.start >> 12; page <= ((uint64_t)w.start + w.len - 1) >> 12; page++)
+        {
+            page_flags[page] |= PAGE_WATCH;
+        }
+        watch_reads |= w.read;
+    }
+    // 同じ範囲・種類のものを1つ外す
+    void remove_watchpoint(const Watchpoint &w)
+    {
+        for (auto it = watchpoints.begin(); it != watchpoints.end(); ++it)
+        {
+            if (it->start == w.start && it->len == w.len && it->read == w.read && it->write == w.write)
+            {
+                watchpoints.erase(it);
+                break;
+            }
+        }
+        for (uint64_t page = w.start >> 12; page <= ((uint64_t)w.start + w.len - 1) >> 12; page++)
+        {
+            page_flags[page] &= ~PAGE_WATCH;
+        }
+        watch_reads = false;
+        std::vector<Watchpoint> rest;
+        rest.swap(watchpoints);
+        for (const Watchpoint &r : rest)
+        {
+            add_watchpoint(r);
+        }
+    }
+
+    // デバッガからの読み書き。MMIO には触らず、変換できなければ false
+    bool debug_read(uint32_t addr, uint8_t *val, Permission perm)
+    {
+        try
+        {
+            uint64_t pa = mmu(addr, perm);
+            if (pa >= memory_size)
+            {
+                return false;
+            }
+            *val = memory[pa];
+        }
+        catch (Exception e)
+        {
+            return false;
+        }
+        return true;
+    }
+    bool debug_write(uint32_t addr, uint8_t val, Permission perm)
+    {
+        try
+        {
+            uint64_t pa = mmu(addr, perm);
+            if (pa >= memory_size)
+            {
+                return false;
+            }
+            // スーパーブロック・チェックポイント・書き込みの記録には反映し、ウォッチポイントには当てない
+            bool hit = watch_hit;
+            if (page_flags[pa >> 12])
+            {
+                flagged_write(pa, 1);
+            }
+            watch_hit = hit;
+            memory[pa] = val;
+        }
+        catch (Exception e)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // 書き込まれたページの記録を始める。記録していないときは書き込みに何も足さない
+    void start_dirty_tracking()
+    {
+        dirty.assign(memory_size / PGSIZE / 64, 0);
+        for (uint32_t page = 0; page < memory_size / PGSIZE; page++)
+        {
+            page_flags[page] |= PAGE_CLEAN;
+        }
+    }
+    bool dirty_tracking()
+    {
+        return !dirty.empty();
+    }
+    bool is_dirty(uint32_t page)
+    {
+        return (dirty[page / 64] >> (page % 64)) & 1;
+    }
+    // 前に clear_dirty してから書き込まれたページ番号 (物理アドレス >> 12) の昇順
+    std::vector<uint32_t> dirty_pages()
+    {
+        std::vector<uint32_t> ret;
+        for (uint32_t i = 0; i < dirty.size(); i++)
+        {
+            for (uint64_t w = dirty[i]; w != 0; w &= w - 1)
+            {
+                ret.push_back(i * 64 + __builtin_ctzll(w));
+            }
+        }
+        return ret;
+    }
+    void clear_dirty()
+    {
+        for (uint32_t page : dirty_pages())
+        {
+            page_flags[page] |= PAGE_CLEAN;
+        }
+        std::fill(dirty.begin(), dirty.end(), 0);
+    }
+    // 書き込まれたページを連続した範囲にまとめて書き出す
+    void write_dirty_pages(const std::string &filename)
+    {
+        FILE *fp = fopen(filename.c_str(), "w");
+        if (!fp)
+        {
+            error_dump("書き込まれたページの出力先を開けませんでした: %s\n", filename.c_str());
+        }
+        std::vector<uint32_t> pages = dirty_pages();
+        fprintf(fp, "# start end pages (total %zu pages, %zu KiB)\n", pages.size(), pages.size() * PGSIZE / 1024);
+        for (size_t i = 0; i < pages.size();)
+        {
+            size_t j = i + 1;
+            while (j < pages.size() && pages[j] == pages[j - 1] + 1)
+            {
+                j++;
+            }
+            fprintf(fp, "%08x %08x %zu\n", pages[i] * PGSIZE, (pages[j - 1] + 1) * PGSIZE - 1, j - i);
+            i = j;
+        }
+        fclose(fp);
     }
 
     void write_mem(uint32_t addr, uint8_t val, Permission perm)
     {
+        last_vaddr = addr;
+        last_wdata = val;
         addr = mmu(addr, perm);
+        if (page_flags[addr >> 12])
+        {
+            flagged_write(addr, 1);
+        }
         if (is_mtimer_addr(addr))
         {
             puts("mtimerにはwordアクセスしてください");
@@ -383,13 +729,20 @@ class Memory
         if (!hook_io_write(addr, val))
         {
             alignment_check(addr, 1);
+            cache_store(addr);
             memory[addr] = val;
         }
     }
 
     void write_mem(uint32_t addr, uint16_t val, Permission perm)
     {
+        last_vaddr = addr;
+        last_wdata = val;
         addr = mmu(addr, perm);
+        if (page_flags[addr >> 12])
+        {
+            flagged_write(addr, 2);
+        }
         if (is_mtimer_addr(addr))
         {
             puts("mtimerにはwordアクセスしてください");
@@ -400,6 +753,7 @@ class Memory
         if (!hook_io_write(addr, val))
         {
             alignment_check(addr, 2);
+            cache_store(addr);
             uint16_t *m = (uint16_t *)memory;
             m[addr / 2] = val;
         }
@@ -407,10 +761,17 @@ class Memory
 
     void write_mem(uint32_t addr, uint32_t val, Permission perm)
     {
+        last_vaddr = addr;
+        last_wdata = val;
         addr = mmu(addr, perm);
+        if (page_flags[addr >> 12])
+        {
+            flagged_write(addr, 4);
+        }
         if (!hook_io_write(addr, val) && !hook_mtimer_write(addr, val))
         {
             alignment_check(addr, 4);
+            cache_store(addr);
             uint32_t *m = (uint32_t *)memory;
             m[addr / 4] = val;
         }
@@ -418,7 +779,12 @@ class Memory
 
     uint8_t read_mem_1(uint32_t addr, Permission perm)
     {
+        last_vaddr = addr;
         addr = mmu(addr, perm);
+        if (watch_reads && (page_flags[addr >> 12] & PAGE_WATCH))
+        {
+            check_watch(addr, 1, false);
+        }
         if (is_mtimer_addr(addr))
         {
             puts("mtimerにはwordアクセスしてください");
@@ -432,12 +798,18 @@ class Memory
             return v;
         }
         alignment_check(addr, 1);
+        cache_load(addr);
         return memory[addr];
     }
 
     uint16_t read_mem_2(uint32_t addr, Permission perm)
     {
+        last_vaddr = addr;
         addr = mmu(addr, perm);
+        if (watch_reads && (page_flags[addr >> 12] & PAGE_WATCH))
+        {
+            check_watch(addr, 2, false);
+        }
         if (is_mtimer_addr(addr))
         {
             puts("mtimerにはwordアクセスしてください");
@@ -451,13 +823,19 @@ class Memory
             return v;
         }
         alignment_check(addr, 2);
+        cache_load(addr);
         uint16_t *m = (uint16_t *)memory;
         return m[addr / 2];
     }
 
     uint32_t read_mem_4(uint32_t addr, Permission perm)
     {
+        last_vaddr = addr;
         addr = mmu(addr, perm);
+        if (watch_reads && (page_flags[addr >> 12] & PAGE_WATCH))
+        {
+            check_watch(addr, 4, false);
+        }
         uint8_t v;
         if (hook_io_read(addr, &v))
         {
@@ -469,6 +847,7 @@ class Memory
             return timerv;
         }
         alignment_check(addr, 4);
+        cache_load(addr);
         uint32_t *m = (uint32_t *)memory;
         return m[addr / 4];
     }
@@ -477,19 +856,65 @@ class Memory
     {
         addr = mmu(addr, perm);
         alignment_check(addr, 4);
+        if (cache)
+        {
+            uint32_t t = cache->fetch(addr);
+            if (cache_timing)
+                mtimer->incr_time(t);
+        }
         uint32_t *m = (uint32_t *)memory;
         return m[addr / 4];
     }
 
-    // set instructions to memory
-    // inst_memが満杯になって死ぬとかないのかな(wakarazu)
-    void mmap(uint32_t addr, uint8_t *data, uint32_t length)
+    // ファイルの offset から filesz バイトを物理アドレス pa に置き、memsz まで 0 で埋める
+    // ファイルとメモリのページ内の位置が揃っていれば、間のページはコピーせずに mmap で貼る
+    void map_file(uint32_t pa, int fd, uint32_t offset, uint32_t filesz, uint32_t memsz)
     {
-        alignment_check(addr, 4);
-        alignment_check(length, 4);
-        for (int i = 0; i < length; i++)
+        if (filesz > memsz || (uint64_t)pa + memsz > memory_size)
+        {
+            error_dump("プログラムがメモリに収まりません: %x (%x bytes)\n", pa, memsz);
+        }
+        uint8_t *dst = memory + pa;
+        uint32_t head = filesz;
+        uint32_t body = 0;
+        if ((pa - offset) % PGSIZE == 0)
+        {
+            uint32_t skip = (PGSIZE - pa % PGSIZE) % PGSIZE;
+            if (skip < filesz && ((filesz - skip) & ~(PGSIZE - 1)) != 0)
+            {
+                body = (filesz - skip) & ~(PGSIZE - 1);
+                if (::mmap(dst + skip, body, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + skip) == MAP_FAILED)
+                {
+                    body = 0;
+                }
+                else
+                {
+                    head = skip;
+                }
+            }
+        }
+        // mmap できなかった残り
+        read_file(fd, dst, head, offset);
+        uint32_t tail = head + body;
+        if (body != 0 && tail < filesz)
         {
-            memory[addr + i] = data[i];
+            read_file(fd, dst + tail, filesz - tail, offset + tail);
+        }
+        memset(dst + filesz, 0, memsz - filesz);
+    }
+
+    static void read_file(int fd, uint8_t *dst, uint32_t len, uint32_t offset)
+    {
+        while (len > 0)
+        {
+            ssize_t n = pread(fd, dst, len, offset);
+            if (n <= 0)
+            {
+                error_dump("プログラムを読み込めませんでした\n");
+            }
+            dst += n;
+            len -= n;
+            offset += n;
         }
     }
 
@@ -540,69 +965,59 @@ float i2f(int x)
 
 class Register
 {
+    friend class MicroBench;
+
     static const int ireg_size = 32;
     static const int freg_size = 32;
-    uint32_t i_registers[ireg_size] = {0};
-    uint32_t f_registers[freg_size] = {0};
+    // x0-x31, f0-f31, ireg_sink の順に並べて、キャッシュラインに揃えた1つの配列に置く
+    static const int freg_base = 32;
+    uint32_t *file;
+
+    Register(const Register &) = delete;
+    Register &operator=(const Register &) = delete;
 
-    static void check_ireg_name(int name, int write)
+  public:
+    static const int file_size = 80;
+    uint32_t ip;
+    Register() : ip(0)
     {
-        if (name < 0 || name > ireg_size)
-        {
-            error_dump("レジスタの番号が不正です: %d\n", name);
-        }
+        file = (uint32_t *)aligned_alloc(64, file_size * sizeof(uint32_t));
+        memset(file, 0, file_size * sizeof(uint32_t));
     }
-    static void check_freg_name(int name)
+    ~Register()
     {
-        if (name < 0 || name > freg_size)
-        {
-            error_dump("レジスタの番号が不正です: %d\n", name);
-        }
+        free(file);
     }
-
-  public:
-    uint32_t ip;
-    Register() : ip(0) {}
-    void set_ireg(int name, uint32_t val)
+    // レジスタの番号はデコーダの5bitのフィールドから来るので範囲の検査はしない
+    // 書き込み先は Decoder::rd_slot のように x0 を ireg_sink にしたものを渡す
+    void set_ireg(int slot, uint32_t val)
     {
-        check_ireg_name(name, 1);
-
-        if (name == 0)
-        {
-            return;
-        }
-        i_registers[name] = val;
+        file[slot] = val;
     }
     void set_freg(int name, float val)
     {
-        check_freg_name(name);
-
-        f_registers[name] = f2i(val);
+        file[freg_base + name] = f2i(val);
     }
     void set_freg_raw(int name, uint32_t val)
     {
-        check_freg_name(name);
-
-        f_registers[name] = val;
+        file[freg_base + name] = val;
     }
     uint32_t get_ireg(int name)
     {
-        check_ireg_name(name, 0);
-        if (name == 0)
-        {
-            return 0;
-        }
-        return i_registers[name];
+        return file[name];
     }
     float get_freg(int name)
     {
-        check_freg_name(name);
-        return i2f(f_registers[name]);
+        return i2f(file[freg_base + name]);
     }
     uint32_t get_freg_raw(int name)
     {
-        check_freg_name(name);
-        return f_registers[name];
+        return file[freg_base + name];
+    }
+    // 整数レジスタを直接読み書きする (スーパーブロック用)
+    uint32_t *iregs()
+    {
+        return file;
     }
 
     void info()
@@ -612,7 +1027,7 @@ class Register
         std::cout << "ip: " << ip << std::endl;
         for (int i = 0; i < ireg_size; i++)
         {
-            std::cout << std::dec << "x" << i << std::hex << ": " << i_registers[i] << " ";
+            std::cout << std::dec << "x" << i << std::hex << ": " << file[i] << " ";
             if (i % 6 == 5)
             {
                 std::cout << std::endl;
@@ -623,7 +1038,7 @@ class Register
         std::cout << "fRegister: " << std::endl;
         for (int i = 0; i < freg_size; i++)
         {
-            std::cout << std::dec << "f" << i << std::hex << ": " << i2f(f_registers[i]) << " ";
+            std::cout << std::dec << "f" << i << std::hex << ": " << i2f(file[freg_base + i]) << " ";
             if (i % 6 == 5)
             {
                 std::cout << std::endl;
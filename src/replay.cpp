@@ -0,0 +1,217 @@
+// 外からの入力 (UART の受信、プロキシカーネルのホストのファイル操作) の記録と再生
+// 記録: 入力があったときの命令数と値・データを順に書く
+// 再生: 同じ命令数で同じ種類の入力が来るはずなので、ホストの代わりにログから返す
+// 1件は 命令数の差分, 種類, 値, データ長, データ (数は LEB128、値は zigzag)
+// 逆実行ではチェックポイントの位置 (mark) まで戻って、記録した所に追いつくまで再生する
+enum InputKind : uint8_t
+{
+    INPUT_END = 0, // 最後に書く (終わったときの命令数)
+    INPUT_UART_RX,
+    INPUT_PK_READ,
+    INPUT_PK_OPEN,
+    INPUT_PK_LSEEK,
+    INPUT_PK_WRITE,
+};
+
+static const char *input_kind_names[] = {"end", "uart-rx", "read", "open", "lseek", "write"};
+static const char input_log_magic[8] = {'R', 'V', 'I', 'N', 'L', 'O', 'G', '1'};
+
+class InputLog
+{
+    FILE *fp;
+    bool replay_mode;
+    std::string filename;
+    const unsigned long long *inst_count;
+    unsigned long long last;
+    // 記録中に巻き戻したら、記録の終わりまで再生してから記録に戻る
+    bool catching_up;
+    long record_end;
+
+    void put_uint(uint64_t v)
+    {
+        do
+        {
+            uint8_t b = v & 0x7f;
+            v >>= 7;
+            fputc(v ? b | 0x80 : b, fp);
+        } while (v);
+    }
+    uint64_t get_uint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int c = fgetc(fp);
+            if (c == EOF)
+            {
+                error_dump("入力ログが途中で終わっています: %s\n", filename.c_str());
+            }
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80))
+            {
+                break;
+            }
+        }
+        return v;
+    }
+
+    void put(uint8_t kind, int32_t value, const void *data, uint32_t len)
+    {
+        put_uint(*inst_count - last);
+        last = *inst_count;
+        fputc(kind, fp);
+        put_uint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+        put_uint(len);
+        // len が 0 のときは data が nullptr のことがある
+        if (len != 0)
+        {
+            fwrite(data, 1, len, fp);
+        }
+        // 落ちても途中までは残るように毎回書き出す
+        fflush(fp);
+    }
+
+    void end_catch_up()
+    {
+        catching_up = false;
+        replay_mode = false;
+        // 読み込みから書き込みに切り替えるときは fseek が要る
+        fseek(fp, 0, SEEK_CUR);
+    }
+
+  public:
+    // チェックポイントに残すログの位置
+    struct Mark
+    {
+        long pos;
+        unsigned long long last;
+    };
+
+    // filename が "" なら一時ファイルに記録する (逆実行のため)
+    InputLog(const std::string &filename, bool replay_mode, const unsigned long long *inst_count)
+        : replay_mode(replay_mode), filename(filename), inst_count(inst_count), last(0), catching_up(false), record_end(0)
+    {
+        if (filename == "")
+        {
+            fp = tmpfile();
+        }
+        else
+        {
+            fp = fopen(filename.c_str(), replay_mode ? "rb" : "w+b");
+        }
+        if (fp == nullptr)
+        {
+            error_dump("入力ログを開けませんでした: %s\n", filename.c_str());
+        }
+        char buf[8];
+        if (!replay_mode)
+        {
+            fwrite(input_log_magic, 1, 8, fp);
+        }
+        else if (fread(buf, 1, 8, fp) != 8 || memcmp(buf, input_log_magic, 8) != 0)
+        {
+            error_dump("入力ログではありません: %s\n", filename.c_str());
+        }
+    }
+    ~InputLog()
+    {
+        fclose(fp);
+    }
+
+    bool replaying()
+    {
+        return replay_mode;
+    }
+
+    void record(InputKind kind, int32_t value, const void *data = nullptr, uint32_t len = 0)
+    {
+        put(kind, value, data, len);
+    }
+
+    // 次の入力を読む。命令数か種類が記録と違えば止める
+    int32_t replay(InputKind kind, std::vector<uint8_t> *data = nullptr)
+    {
+        unsigned long long at = last + get_uint();
+        int k = fgetc(fp);
+        uint32_t z = get_uint();
+        int32_t value = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+        uint32_t len = get_uint();
+        std::vector<uint8_t> buf(len);
+        if (fread(buf.data(), 1, len, fp) != len)
+        {
+            error_dump("入力ログが途中で終わっています: %s\n", filename.c_str());
+        }
+        if (k != kind || at != *inst_count)
+        {
+            error_dump("記録と実行がずれました: 命令 %llu で %s の入力 (記録では命令 %llu で %s)\n",
+                       *inst_count, input_kind_names[kind], at, k >= 0 && k <= INPUT_PK_WRITE ? input_kind_names[k] : "?");
+        }
+        last = at;
+        if (catching_up && ftell(fp) == record_end)
+        {
+            end_catch_up();
+        }
+        if (data)
+        {
+            *data = buf;
+        }
+        return value;
+    }
+
+    Mark mark()
+    {
+        return {ftell(fp), last};
+    }
+
+    // mark の位置に戻る。記録中なら、それまでに記録した入力を再生してから記録を続ける
+    void rewind(const Mark &mk)
+    {
+        if (!replay_mode || catching_up)
+        {
+            if (!catching_up)
+            {
+                record_end = ftell(fp);
+            }
+            catching_up = mk.pos != record_end;
+            replay_mode = catching_up;
+        }
+        fseek(fp, mk.pos, SEEK_SET);
+        last = mk.last;
+    }
+
+    // 記録: 終わりの印を書く / 再生: 記録と同じところで終わったか確かめる
+    void finish()
+    {
+        if (catching_up)
+        {
+            // 巻き戻した後の実行で終わったので、その先の記録は捨てる
+            end_catch_up();
+            if (ftruncate(fileno(fp), ftell(fp)) != 0)
+            {
+                warn_dump("入力ログを切り詰められませんでした: %s\n", filename.c_str());
+            }
+        }
+        if (!replay_mode)
+        {
+            put(INPUT_END, 0, nullptr, 0);
+            return;
+        }
+        int c = fgetc(fp);
+        if (c == EOF)
+        {
+            warn_dump("入力ログに終わりの印がありません: %s\n", filename.c_str());
+            return;
+        }
+        ungetc(c, fp);
+        unsigned long long at = last + get_uint();
+        int k = fgetc(fp);
+        if (k != INPUT_END)
+        {
+            warn_dump("記録された入力が残っています (命令 %llu 以降)\n", at);
+        }
+        else if (at != *inst_count)
+        {
+            warn_dump("記録では命令 %llu で終わっていますが、再生は命令 %llu で終わりました\n", at, *inst_count);
+        }
+    }
+};
@@ -8,8 +8,57 @@ class Settings
     bool show_inst_value;
     bool show_io;
     bool hide_error_dump;
+    bool profile;
+    bool callgraph;
+    bool cache;
+    bool cache_timing;
+    bool pipeline;
     int ip;
     unsigned long long wait;
+    // ブレークポイント (b [ip] と --break) とウォッチポイント (--watch)
+    std::vector<uint32_t> break_ips;
+    std::vector<std::string> watch_specs;
+
+    unsigned long long profile_interval;
+    std::string profile_out;
+    std::string callgraph_out;
+    std::string trace_file;
+    int trace_compress;
+    std::string cosim_file;
+    unsigned long long cosim_batch;
+    std::string cache_l1i;
+    std::string cache_l1d;
+    std::string cache_l2;
+    std::string cache_latency;
+    std::string cache_out;
+    std::string bpred;
+    unsigned bpred_bits;
+    unsigned bpred_history;
+    unsigned bpred_ras;
+    std::string bpred_out;
+    std::string pipeline_latency;
+    double pipeline_freq;
+    std::string pipeline_out;
+    std::string timing_file;
+    std::string stat_out;
+    bool hostperf;
+    std::string hostperf_out;
+    double hostperf_interval;
+    int hostperf_sample;
+    bool hostperf_counters;
+    bool fusion;
+    bool superblock;
+    uint32_t superblock_threshold;
+    std::string tcache_file;
+    bool pk;
+    std::string pk_root;
+    double pk_freq;
+    std::string record_file;
+    std::string replay_file;
+    unsigned long long checkpoint_interval;
+    uint32_t checkpoint_keep;
+    std::string dirty_out;
+    std::string gdb;
 
     Settings(const char *cmd_arg, const int x, unsigned long long y)
     {
@@ -20,9 +69,55 @@ class Settings
         show_inst_value = false;
         show_io = false;
         hide_error_dump = false;
+        profile = false;
+        callgraph = false;
+        cache = false;
+        cache_timing = false;
+        pipeline = false;
         ip = x;
         wait = y;
 
+        profile_interval = 1;
+        profile_out = "profile";
+        callgraph_out = "callgraph";
+        trace_file = "";
+        trace_compress = 0;
+        cosim_file = "";
+        cosim_batch = 1024;
+        cache_l1i = "16k:2:64";
+        cache_l1d = "16k:2:64:wb";
+        cache_l2 = "128k:4:64:wb";
+        cache_latency = "1:10:40";
+        cache_out = "cache.out";
+        bpred = "";
+        bpred_bits = 12;
+        bpred_history = 12;
+        bpred_ras = 8;
+        bpred_out = "bpred.out";
+        pipeline_latency = "";
+        pipeline_freq = 100;
+        pipeline_out = "pipeline.out";
+        timing_file = "";
+        stat_out = "";
+        hostperf = false;
+        hostperf_out = "hostperf.json";
+        hostperf_interval = 0;
+        hostperf_sample = 1000;
+        hostperf_counters = false;
+        fusion = true;
+        superblock = true;
+        superblock_threshold = 256;
+        tcache_file = "";
+        pk = false;
+        pk_root = ".";
+        pk_freq = 100;
+        record_file = "";
+        replay_file = "";
+        checkpoint_interval = 0;
+        checkpoint_keep = 32;
+        dirty_out = "";
+        gdb = "";
+
         for (const char *c = &cmd_arg[0]; *c; c++)
         {
             switch (*c)
@@ -48,6 +143,12 @@ class Settings
             case 'h':
                 hide_error_dump = true;
                 break;
+            case 'p':
+                profile = true;
+                break;
+            case 'g':
+                callgraph = true;
+                break;
             case 'a':
                 show_stack = true;
                 show_registers = true;
@@ -55,5 +156,224 @@ class Settings
                 show_io = true;
             }
         }
+        if (break_point)
+        {
+            break_ips.push_back(ip);
+        }
+    }
+
+    // --name=value 形式のオプション
+    // 知らない名前ならfalseを返す
+    bool parse_long_option(const std::string &arg)
+    {
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        std::string val = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "profile-interval")
+        {
+            profile = true;
+            profile_interval = strtoull(val.c_str(), NULL, 0);
+        }
+        else if (name == "profile-out")
+        {
+            profile = true;
+            profile_out = val;
+        }
+        else if (name == "callgraph-out")
+        {
+            callgraph = true;
+            callgraph_out = val;
+        }
+        else if (name == "trace")
+        {
+            trace_file = val;
+        }
+        else if (name == "trace-compress")
+        {
+            trace_compress = atoi(val.c_str());
+        }
+        else if (name == "cosim")
+        {
+            cosim_file = val;
+        }
+        else if (name == "cosim-batch")
+        {
+            cosim_batch = strtoull(val.c_str(), NULL, 0);
+        }
+        else if (name == "cache")
+        {
+            cache = true;
+        }
+        else if (name == "cache-l1i")
+        {
+            cache = true;
+            cache_l1i = val;
+        }
+        else if (name == "cache-l1d")
+        {
+            cache = true;
+            cache_l1d = val;
+        }
+        else if (name == "cache-l2")
+        {
+            cache = true;
+            cache_l2 = val;
+        }
+        else if (name == "cache-latency")
+        {
+            cache = true;
+            cache_latency = val;
+        }
+        else if (name == "cache-timing")
+        {
+            cache = true;
+            cache_timing = true;
+        }
+        else if (name == "cache-out")
+        {
+            cache = true;
+            cache_out = val;
+        }
+        else if (name == "bpred")
+        {
+            bpred = val == "" ? "all" : val;
+        }
+        else if (name == "bpred-bits")
+        {
+            bpred_bits = atoi(val.c_str());
+        }
+        else if (name == "bpred-history")
+        {
+            bpred_history = atoi(val.c_str());
+        }
+        else if (name == "bpred-ras")
+        {
+            bpred_ras = atoi(val.c_str());
+        }
+        else if (name == "bpred-out")
+        {
+            bpred_out = val;
+        }
+        else if (name == "pipeline")
+        {
+            pipeline = true;
+        }
+        else if (name == "pipeline-latency")
+        {
+            pipeline = true;
+            pipeline_latency = val;
+        }
+        else if (name == "pipeline-freq")
+        {
+            pipeline = true;
+            pipeline_freq = atof(val.c_str());
+        }
+        else if (name == "pipeline-out")
+        {
+            pipeline = true;
+            pipeline_out = val;
+        }
+        else if (name == "timing")
+        {
+            timing_file = val;
+        }
+        else if (name == "stat-out")
+        {
+            stat_out = val;
+        }
+        else if (name == "hostperf")
+        {
+            hostperf = true;
+            if (val != "")
+            {
+                hostperf_out = val;
+            }
+        }
+        else if (name == "hostperf-interval")
+        {
+            hostperf = true;
+            hostperf_interval = atof(val.c_str());
+        }
+        else if (name == "hostperf-sample")
+        {
+            hostperf = true;
+            hostperf_sample = atoi(val.c_str());
+        }
+        else if (name == "hostperf-counters")
+        {
+            hostperf = true;
+            hostperf_counters = true;
+        }
+        else if (name == "no-fusion")
+        {
+            fusion = false;
+        }
+        else if (name == "no-superblock")
+        {
+            superblock = false;
+        }
+        else if (name == "superblock-threshold")
+        {
+            superblock_threshold = strtoul(val.c_str(), NULL, 0);
+        }
+        else if (name == "tcache")
+        {
+            tcache_file = val;
+        }
+        else if (name == "pk")
+        {
+            pk = true;
+            if (val != "")
+            {
+                pk_root = val;
+            }
+        }
+        else if (name == "pk-freq")
+        {
+            pk_freq = atof(val.c_str());
+        }
+        else if (name == "record")
+        {
+            record_file = val;
+        }
+        else if (name == "replay")
+        {
+            replay_file = val;
+        }
+        else if (name == "break")
+        {
+            // カンマ区切りで複数書ける
+            break_point = true;
+            for (size_t pos = 0; pos != std::string::npos;)
+            {
+                size_t comma = val.find(',', pos);
+                break_ips.push_back(strtoul(val.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos).c_str(), NULL, 0));
+                pos = comma == std::string::npos ? comma : comma + 1;
+            }
+        }
+        else if (name == "watch")
+        {
+            break_point = true;
+            watch_specs.push_back(val);
+        }
+        else if (name == "gdb")
+        {
+            gdb = val == "" ? "1234" : val;
+        }
+        else if (name == "dirty-out")
+        {
+            dirty_out = val;
+        }
+        else if (name == "checkpoint")
+        {
+            checkpoint_interval = 10000000;
+            sscanf(val.c_str(), "%llu:%u", &checkpoint_interval, &checkpoint_keep);
+        }
+        else
+        {
+            return false;
+        }
+        return true;
     }
 };
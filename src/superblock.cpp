@@ -0,0 +1,456 @@
+// スーパーブロック (ホットなループのトレース)
+// 実行回数が閾値を超えた基本ブロックの先頭から、分岐はよく行く方を辿って命令を繋げる
+// 逆の方向に行ったときはサイドエグジットでインタプリタに戻る
+// 命令はすべて同じページ内に限り、整数命令とロード・ストアだけを扱う
+// save/load でファイルに残して、次の実行では数え直さずに最初から使う
+
+// 事前にデコードした1命令
+struct SbOp
+{
+    InstId id;
+    uint8_t rd; // Decoder::rd_slot
+    uint8_t rs1;
+    uint8_t rs2;
+    bool branch;
+    bool taken;       // 分岐: 想定している方向
+    uint32_t code;
+    uint32_t imm;     // インタプリタと同じように求めた即値 (auipc/jal は結果の値)
+    uint32_t ip;      // この命令のアドレス
+    uint32_t next_ip; // 想定している次の命令のアドレス
+    uint32_t exit_ip; // 分岐: 想定と逆に行ったときの行き先
+    uint32_t cost;    // 進める仮想時間
+};
+
+struct Superblock
+{
+    uint32_t head;
+    uint64_t head_pa;
+    uint64_t gen; // 作ったときの Memory::code_gen
+    bool loop;    // 最後の命令の次が先頭に戻る
+    std::vector<SbOp> ops;
+};
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t h = 0xcbf29ce484222325ULL)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// 実行ファイルの中身のハッシュ (作り直したら別物として扱う)
+static uint64_t emulator_build_id()
+{
+    std::ifstream ifs("/proc/self/exe", std::ios::binary);
+    std::vector<char> buf(1 << 16);
+    uint64_t h = fnv1a("", 0);
+    while (ifs.read(buf.data(), buf.size()) || ifs.gcount() > 0)
+    {
+        h = fnv1a(buf.data(), ifs.gcount(), h);
+    }
+    return h;
+}
+
+// 翻訳キャッシュのファイル
+//   ヘッダ, (SbFileBlock, SbFileOp * n_ops) * count
+// 命令のアドレスと命令語と分岐の方向だけを残し、読み込むときにデコードし直す
+struct SbFileHeader
+{
+    char magic[8];
+    uint64_t build_id;
+    uint32_t op_size;
+    uint32_t count;
+};
+
+struct SbFileBlock
+{
+    uint32_t head;
+    uint32_t n_ops;
+    uint64_t head_pa;
+    uint64_t code_hash; // 命令列のハッシュ
+    uint32_t loop;
+    uint32_t reserved;
+};
+
+// mmap したまま読むので、次の SbFileBlock が8バイト境界に来るように16バイトにしておく
+struct SbFileOp
+{
+    uint32_t ip;
+    uint32_t code;
+    uint32_t taken;
+    uint32_t reserved;
+};
+
+static const char sb_file_magic[8] = {'S', 'B', 'C', 'A', 'C', 'H', 'E', '2'};
+
+class SuperblockCache
+{
+    static const size_t max_ops = 256;
+    static const size_t max_blocks = 4096;
+
+    std::vector<Superblock *> blocks;
+
+    // 前の実行で作ったもの (mmap したファイルの中を指す)
+    void *file_map;
+    size_t file_size;
+    std::map<std::pair<uint32_t, uint64_t>, const SbFileBlock *> persisted;
+
+    template <class Op>
+    static uint64_t code_hash(const Op *ops, size_t n)
+    {
+        uint64_t h = fnv1a("", 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            h = fnv1a(&ops[i].ip, sizeof(uint32_t), h);
+            h = fnv1a(&ops[i].code, sizeof(uint32_t), h);
+        }
+        return h;
+    }
+
+    static bool supported(InstId id)
+    {
+        switch (id)
+        {
+        case ID_JALR:
+        case ID_FLW:
+        case ID_FSW:
+        case ID_FADD:
+        case ID_FSUB:
+        case ID_FMUL:
+        case ID_FDIV:
+        case ID_FSQRT:
+        case ID_FMADD:
+        case ID_FMSUB:
+        case ID_FNMSUB:
+        case ID_FNMADD:
+        case ID_FSGNJ:
+        case ID_FSGNJN:
+        case ID_FSGNJX:
+        case ID_FCVT_W_S:
+        case ID_FCVT_S_W:
+        case ID_FEQ:
+        case ID_FLT:
+        case ID_FLE:
+        case ID_CSRRW:
+        case ID_CSRRS:
+        case ID_CSRRC:
+        case ID_CSRRWI:
+        case ID_CSRRSI:
+        case ID_CSRRCI:
+        case ID_ECALL:
+        case ID_SRET:
+        case ID_UNKNOWN:
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    // taken: 分岐ならよく行く方
+    static SbOp make_op(DecodedInst *di, uint32_t ip, bool taken)
+    {
+        Decoder &d = di->d;
+        SbOp op;
+        op.id = di->id;
+        op.rd = d.rd_slot;
+        op.rs1 = d.rs1();
+        op.rs2 = d.rs2();
+        op.branch = false;
+        op.taken = false;
+        op.code = d.code;
+        op.ip = ip;
+        op.next_ip = ip + 4;
+        op.exit_ip = 0;
+        op.cost = di->cost;
+        switch (op.id)
+        {
+        case ID_LUI:
+            op.imm = d.u_type_imm();
+            break;
+        case ID_AUIPC:
+            op.imm = ip + d.u_type_imm();
+            break;
+        case ID_JAL:
+            op.imm = ip + 4;
+            op.next_ip = (int32_t)ip + d.jal_imm();
+            break;
+        case ID_ORI:
+            op.imm = d.i_type_imm() & 0b111111111111;
+            break;
+        case ID_SLLI:
+        case ID_SRLI:
+        case ID_SRAI:
+            op.imm = d.i_type_imm() & 0x1f;
+            break;
+        case ID_SB:
+        case ID_SH:
+        case ID_SW:
+            op.imm = d.s_type_imm();
+            break;
+        case ID_BEQ:
+        case ID_BNE:
+        case ID_BLT:
+        case ID_BGE:
+        case ID_BLTU:
+        case ID_BGEU:
+        {
+            uint32_t target = (int32_t)ip + d.b_type_imm();
+            op.branch = true;
+            op.taken = taken;
+            op.next_ip = op.taken ? target : ip + 4;
+            op.exit_ip = op.taken ? ip + 4 : target;
+            break;
+        }
+        default:
+            op.imm = d.i_type_imm();
+            break;
+        }
+        return op;
+    }
+
+    Superblock *add(Superblock *sb, Memory *m)
+    {
+        m->set_page_flag(sb->head_pa, PAGE_CODE);
+        sb->gen = m->code_gen;
+        blocks.push_back(sb);
+        return sb;
+    }
+
+  public:
+    SuperblockCache() : file_map(nullptr), file_size(0) {}
+    ~SuperblockCache()
+    {
+        for (Superblock *sb : blocks)
+        {
+            delete sb;
+        }
+        if (file_map)
+        {
+            munmap(file_map, file_size);
+        }
+    }
+
+    size_t size()
+    {
+        return blocks.size();
+    }
+
+    // 命令列が作ったときと同じか
+    bool unchanged(Superblock *sb, Permission perm, Memory *m)
+    {
+        try
+        {
+            for (const SbOp &op : sb->ops)
+            {
+                if (m->get_inst(op.ip, perm) != op.code)
+                {
+                    return false;
+                }
+            }
+        }
+        catch (Exception e)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    void release(Superblock *sb)
+    {
+        auto it = std::find(blocks.begin(), blocks.end(), sb);
+        if (it != blocks.end())
+        {
+            *it = blocks.back();
+            blocks.pop_back();
+        }
+        delete sb;
+    }
+
+    // head から辿ってスーパーブロックを作る。2命令未満にしかならなければ nullptr
+    Superblock *build(uint32_t head, Permission perm, Memory *m, DecodeCache *decode_cache)
+    {
+        if (blocks.size() >= max_blocks)
+        {
+            return nullptr;
+        }
+        Superblock *sb = new Superblock;
+        sb->head = head;
+        sb->loop = false;
+        uint32_t page = head & ~0xfffu;
+        uint32_t cur = head;
+        while (sb->ops.size() < max_ops && (cur & ~0xfffu) == page)
+        {
+            if (!sb->ops.empty() && cur == head)
+            {
+                sb->loop = true;
+                break;
+            }
+            uint32_t code;
+            try
+            {
+                code = m->get_inst(cur, perm);
+            }
+            catch (Exception e)
+            {
+                break;
+            }
+            DecodedInst *di = decode_cache->lookup(cur, code);
+            if (!supported(di->id))
+            {
+                break;
+            }
+            sb->ops.push_back(make_op(di, cur, di->taken > di->not_taken));
+            cur = sb->ops.back().next_ip;
+        }
+        if (sb->ops.size() < 2)
+        {
+            delete sb;
+            return nullptr;
+        }
+        sb->head_pa = m->translate(head, perm);
+        return add(sb, m);
+    }
+
+    // 前の実行で head から作ったものがあり、命令が同じならそれを使う
+    Superblock *adopt(uint32_t head, Permission perm, Memory *m, DecodeCache *decode_cache)
+    {
+        if (persisted.empty() || blocks.size() >= max_blocks)
+        {
+            return nullptr;
+        }
+        uint64_t pa = m->translate(head, perm);
+        auto it = persisted.find(std::make_pair(head, pa));
+        if (it == persisted.end())
+        {
+            return nullptr;
+        }
+        const SbFileBlock *fb = it->second;
+        const SbFileOp *ops = (const SbFileOp *)(fb + 1);
+        Superblock *sb = new Superblock;
+        sb->head = head;
+        sb->head_pa = pa;
+        sb->loop = fb->loop;
+        // ファイルの中身は信用せず、build と同じように作り直して辻褄が合うか確かめる
+        uint32_t page = head & ~0xfffu;
+        uint32_t cur = head;
+        for (uint32_t i = 0; i < fb->n_ops; i++)
+        {
+            DecodedInst *di = decode_cache->lookup(ops[i].ip, ops[i].code);
+            if (ops[i].ip != cur || (cur & ~0xfffu) != page || !supported(di->id))
+            {
+                delete sb;
+                return nullptr;
+            }
+            sb->ops.push_back(make_op(di, cur, ops[i].taken));
+            cur = sb->ops.back().next_ip;
+        }
+        if ((sb->loop && cur != head) || !unchanged(sb, perm, m))
+        {
+            delete sb;
+            return nullptr;
+        }
+        return add(sb, m);
+    }
+
+    // 作ってあったものを読み込む。ファイルがない・別のビルドのものなら何もしない
+    void load(const std::string &filename, uint64_t build_id)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SbFileHeader))
+        {
+            close(fd);
+            return;
+        }
+        void *p = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            return;
+        }
+        file_map = p;
+        file_size = st.st_size;
+        const SbFileHeader *h = (const SbFileHeader *)p;
+        if (memcmp(h->magic, sb_file_magic, sizeof(sb_file_magic)) != 0 || h->build_id != build_id ||
+            h->op_size != sizeof(SbFileOp))
+        {
+            return;
+        }
+        const char *cur = (const char *)(h + 1);
+        const char *end = (const char *)p + file_size;
+        for (uint32_t i = 0; i < h->count; i++)
+        {
+            const SbFileBlock *fb = (const SbFileBlock *)cur;
+            if (cur + sizeof(SbFileBlock) > end ||
+                cur + sizeof(SbFileBlock) + (size_t)fb->n_ops * sizeof(SbFileOp) > end)
+            {
+                warn_dump("翻訳キャッシュが壊れています: %s\n", filename.c_str());
+                persisted.clear();
+                return;
+            }
+            const SbFileOp *ops = (const SbFileOp *)(fb + 1);
+            if (fb->n_ops >= 2 && fb->n_ops <= max_ops && code_hash(ops, fb->n_ops) == fb->code_hash)
+            {
+                persisted[std::make_pair(fb->head, fb->head_pa)] = fb;
+            }
+            cur += sizeof(SbFileBlock) + (size_t)fb->n_ops * sizeof(SbFileOp);
+        }
+    }
+
+    // 今ある物と、読み込んだけれど使わなかった物を書き出す
+    void save(const std::string &filename, uint64_t build_id)
+    {
+        std::map<std::pair<uint32_t, uint64_t>, std::pair<SbFileBlock, std::vector<SbFileOp>>> out;
+        for (auto &p : persisted)
+        {
+            const SbFileOp *ops = (const SbFileOp *)(p.second + 1);
+            out[p.first] = std::make_pair(*p.second, std::vector<SbFileOp>(ops, ops + p.second->n_ops));
+        }
+        for (Superblock *sb : blocks)
+        {
+            SbFileBlock fb = {};
+            fb.head = sb->head;
+            fb.n_ops = sb->ops.size();
+            fb.head_pa = sb->head_pa;
+            fb.code_hash = code_hash(sb->ops.data(), sb->ops.size());
+            fb.loop = sb->loop;
+            std::vector<SbFileOp> ops;
+            for (const SbOp &op : sb->ops)
+            {
+                ops.push_back({op.ip, op.code, op.taken, 0});
+            }
+            out[std::make_pair(sb->head, sb->head_pa)] = std::make_pair(fb, ops);
+        }
+
+        // 同時に走っている他の実行と混ざらないように別名で書いてから置き換える
+        std::string tmp = filename + "." + std::to_string(getpid());
+        FILE *fp = fopen(tmp.c_str(), "wb");
+        if (fp == nullptr)
+        {
+            warn_dump("%s を開けませんでした\n", tmp.c_str());
+            return;
+        }
+        SbFileHeader h = {};
+        memcpy(h.magic, sb_file_magic, sizeof(sb_file_magic));
+        h.build_id = build_id;
+        h.op_size = sizeof(SbFileOp);
+        h.count = out.size();
+        fwrite(&h, sizeof(h), 1, fp);
+        for (auto &o : out)
+        {
+            fwrite(&o.second.first, sizeof(SbFileBlock), 1, fp);
+            fwrite(o.second.second.data(), sizeof(SbFileOp), o.second.first.n_ops, fp);
+        }
+        if (fclose(fp) != 0 || rename(tmp.c_str(), filename.c_str()) != 0)
+        {
+            warn_dump("%s に書き込めませんでした\n", filename.c_str());
+            unlink(tmp.c_str());
+        }
+    }
+};
@@ -0,0 +1,462 @@
+// ユーザモードの ecall をホストで処理するプロキシカーネル (riscv-pk と同じ番号・引数)
+// a7: システムコール番号, a0-a5: 引数, a0: 戻り値 (失敗したら -errno)
+// ファイルは root 以下だけを開ける。時刻は仮想時間を freq_mhz で割って求める
+enum Syscall : uint32_t
+{
+    SYS_OPENAT = 56,
+    SYS_CLOSE = 57,
+    SYS_LSEEK = 62,
+    SYS_READ = 63,
+    SYS_WRITE = 64,
+    SYS_EXIT = 93,
+    SYS_EXIT_GROUP = 94,
+    SYS_GETTIMEOFDAY = 169,
+    SYS_BRK = 214,
+    SYS_OPEN = 1024,
+};
+
+class ProxyKernel
+{
+    static const int reg_a0 = 10;
+    static const int reg_a7 = 17;
+    static const uint32_t io_chunk = 4096;
+    // 再生中に開いたファイル (ホストの fd はない)
+    static const int replayed_fd = -2;
+
+    std::string root;
+    double freq_mhz;
+    uint32_t brk_start;
+    uint32_t brk_cur;
+    // ゲストの fd からホストの fd (0-2 はそのまま標準入出力)
+    std::map<uint32_t, int> files;
+    uint32_t next_fd;
+
+    // ゲストのメモリとの間のコピー。ページフォルトなら false
+    bool copy_from_guest(Memory *m, uint32_t va, uint8_t *buf, uint32_t len, Permission perm)
+    {
+        try
+        {
+            for (uint32_t i = 0; i < len; i++)
+            {
+                buf[i] = m->read_mem_1(va + i, perm);
+            }
+        }
+        catch (Exception e)
+        {
+            return false;
+        }
+        return true;
+    }
+    bool copy_to_guest(Memory *m, uint32_t va, const uint8_t *buf, uint32_t len, Permission perm)
+    {
+        try
+        {
+            for (uint32_t i = 0; i < len; i++)
+            {
+                m->write_mem(va + i, buf[i], perm.write_on());
+            }
+        }
+        catch (Exception e)
+        {
+            return false;
+        }
+        return true;
+    }
+    bool read_string(Memory *m, uint32_t va, std::string &s, Permission perm)
+    {
+        s.clear();
+        for (uint32_t i = 0; i < 4096; i++)
+        {
+            uint8_t c;
+            if (!copy_from_guest(m, va + i, &c, 1, perm))
+            {
+                return false;
+            }
+            if (c == '\0')
+            {
+                return true;
+            }
+            s += c;
+        }
+        return false;
+    }
+
+    int host_fd(uint32_t fd)
+    {
+        if (fd <= 2)
+        {
+            return fd;
+        }
+        auto it = files.find(fd);
+        return it == files.end() ? -1 : it->second;
+    }
+
+    int32_t sys_write(Memory *m, uint32_t fd, uint32_t buf, uint32_t len, Permission perm)
+    {
+        int hfd = host_fd(fd);
+        if (hfd == -1 || hfd == 0)
+        {
+            return -EBADF;
+        }
+        std::vector<uint8_t> data(std::min(len, io_chunk));
+        uint32_t done = 0;
+        while (done < len)
+        {
+            uint32_t n = std::min(len - done, io_chunk);
+            if (!copy_from_guest(m, buf + done, data.data(), n, perm))
+            {
+                return done ? done : -EFAULT;
+            }
+            // UART の出力と順番が入れ替わらないように標準出力は std::cout を使う
+            if (hfd == 1 || hfd == 2)
+            {
+                if (!muted)
+                {
+                    if (hfd == 1)
+                    {
+                        std::cout.write((const char *)data.data(), n) << std::flush;
+                    }
+                    else
+                    {
+                        fwrite(data.data(), 1, n, stderr);
+                    }
+                }
+            }
+            else
+            {
+                // ファイルへの書き込みの結果はホストに依るので記録・再生する
+                int32_t ret;
+                if (input_log && input_log->replaying())
+                {
+                    ret = input_log->replay(INPUT_PK_WRITE);
+                }
+                else
+                {
+                    ret = write(hfd, data.data(), n) < 0 ? -errno : n;
+                    if (input_log)
+                    {
+                        input_log->record(INPUT_PK_WRITE, ret);
+                    }
+                }
+                if (ret != (int32_t)n)
+                {
+                    return done ? done : ret;
+                }
+            }
+            done += n;
+        }
+        return done;
+    }
+
+    int32_t sys_read(Memory *m, uint32_t fd, uint32_t buf, uint32_t len, Permission perm)
+    {
+        int hfd = host_fd(fd);
+        if (hfd == -1 || hfd == 1 || hfd == 2)
+        {
+            return -EBADF;
+        }
+        std::vector<uint8_t> data;
+        int32_t ret;
+        if (input_log && input_log->replaying())
+        {
+            ret = input_log->replay(INPUT_PK_READ, &data);
+        }
+        else
+        {
+            // 1回に読むのは io_chunk まで (足りない分はゲストがもう一度 read する)
+            data.resize(std::min(len, io_chunk));
+            ssize_t got = 0;
+            if (hfd == 0)
+            {
+                // 標準入力は UART と同じく stdio で読む。端末のように1行ずつ返す
+                int c = 0;
+                while ((size_t)got < data.size() && c != '\n' && (c = getchar()) != EOF)
+                {
+                    data[got++] = c;
+                }
+            }
+            else
+            {
+                got = read(hfd, data.data(), data.size());
+            }
+            ret = got < 0 ? -errno : got;
+            data.resize(got < 0 ? 0 : got);
+            if (input_log)
+            {
+                input_log->record(INPUT_PK_READ, ret, data.data(), data.size());
+            }
+        }
+        if (!data.empty() && !copy_to_guest(m, buf, data.data(), data.size(), perm))
+        {
+            return -EFAULT;
+        }
+        return ret;
+    }
+
+    // root から1段ずつ openat でたどって開く。途中のディレクトリも含めてシンボリックリンクはたどらない
+    // 失敗したら -errno
+    int open_beneath(const std::string &p, int flags, mode_t mode)
+    {
+        int dir = open(root.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dir < 0)
+        {
+            return -errno;
+        }
+        std::string rest = p;
+        while (1)
+        {
+            size_t slash = rest.find('/');
+            std::string comp = rest.substr(0, slash);
+            if (slash == std::string::npos)
+            {
+                int fd = openat(dir, comp == "" ? "." : comp.c_str(), flags | O_NOFOLLOW, mode);
+                int err = errno;
+                close(dir);
+                return fd < 0 ? -err : fd;
+            }
+            rest = rest.substr(slash + 1);
+            if (comp == "" || comp == ".")
+            {
+                continue;
+            }
+            int next = openat(dir, comp.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            int err = errno;
+            close(dir);
+            if (next < 0)
+            {
+                return -err;
+            }
+            dir = next;
+        }
+    }
+
+    int32_t sys_open(Memory *m, uint32_t path, uint32_t flags, uint32_t mode, Permission perm)
+    {
+        std::string p;
+        if (!read_string(m, path, p, perm))
+        {
+            return -EFAULT;
+        }
+        // root の外に出られないように .. を含むパスは断る
+        std::string rest = p;
+        while (rest != "")
+        {
+            size_t slash = rest.find('/');
+            std::string comp = rest.substr(0, slash);
+            if (comp == "..")
+            {
+                return -EACCES;
+            }
+            rest = slash == std::string::npos ? "" : rest.substr(slash + 1);
+        }
+        // 再生するときはホストのファイルを使わない (fd だけ割り当てる)
+        int hfd = replayed_fd;
+        if (input_log && input_log->replaying())
+        {
+            int32_t ret = input_log->replay(INPUT_PK_OPEN);
+            if (ret < 0)
+            {
+                return ret;
+            }
+        }
+        else
+        {
+            // ゲストの O_* はホスト (Linux) と同じ値
+            int hflags = flags & (O_ACCMODE | O_CREAT | O_EXCL | O_TRUNC | O_APPEND);
+            hfd = open_beneath(p, hflags, mode & 0777);
+            if (input_log)
+            {
+                input_log->record(INPUT_PK_OPEN, hfd < 0 ? hfd : 0);
+            }
+            if (hfd < 0)
+            {
+                return hfd;
+            }
+        }
+        uint32_t fd = next_fd++;
+        files[fd] = hfd;
+        return fd;
+    }
+
+    int32_t sys_close(uint32_t fd)
+    {
+        if (fd <= 2)
+        {
+            return 0;
+        }
+        auto it = files.find(fd);
+        if (it == files.end())
+        {
+            return -EBADF;
+        }
+        if (it->second >= 0)
+        {
+            close(it->second);
+        }
+        files.erase(it);
+        return 0;
+    }
+
+    int32_t sys_lseek(uint32_t fd, int32_t offset, uint32_t whence)
+    {
+        if (fd <= 2)
+        {
+            return -ESPIPE;
+        }
+        if (files.find(fd) == files.end())
+        {
+            return -EBADF;
+        }
+        if (input_log && input_log->replaying())
+        {
+            return input_log->replay(INPUT_PK_LSEEK);
+        }
+        off_t ret = lseek(files[fd], offset, whence);
+        int32_t value = ret < 0 ? -errno : (int32_t)ret;
+        if (input_log)
+        {
+            input_log->record(INPUT_PK_LSEEK, value);
+        }
+        return value;
+    }
+
+    // newlib (rv32) の struct timeval: 64bit の tv_sec と 32bit の tv_usec
+    int32_t sys_gettimeofday(Memory *m, MTIMER *mtimer, uint32_t tv, Permission perm)
+    {
+        uint64_t cycles = ((uint64_t)mtimer->read_mtimeh() << 32) | mtimer->read_mtimel();
+        uint64_t usec = cycles / freq_mhz;
+        uint8_t buf[16] = {0};
+        uint64_t sec = usec / 1000000;
+        uint32_t frac = usec % 1000000;
+        memcpy(buf, &sec, 8);
+        memcpy(buf + 8, &frac, 4);
+        return copy_to_guest(m, tv, buf, sizeof(buf), perm) ? 0 : -EFAULT;
+    }
+
+    int32_t sys_brk(uint32_t addr)
+    {
+        if (addr >= brk_start && addr < stack_top - (1 << 20))
+        {
+            brk_cur = addr;
+        }
+        return brk_cur;
+    }
+
+  public:
+    // スタックは stack_top から下に伸ばす
+    static const uint32_t stack_top = 0x7ffff000;
+
+    bool halted;
+    int exit_code;
+    // 記録・再生しないなら nullptr
+    InputLog *input_log;
+    // 逆実行で実行し直している間は標準出力に書かない
+    bool muted;
+
+    // チェックポイントに残すもの
+    // ファイルの中身や位置は戻せないので、実行し直す間は入力ログから再生する
+    struct State
+    {
+        uint32_t brk_cur;
+        uint32_t next_fd;
+        std::map<uint32_t, int> files;
+    };
+    State state()
+    {
+        return {brk_cur, next_fd, files};
+    }
+    void restore(const State &s)
+    {
+        brk_cur = s.brk_cur;
+        next_fd = s.next_fd;
+        // 後で開いたファイルは閉じる。後で閉じたファイルはホストの fd がもうない
+        std::map<uint32_t, int> restored = s.files;
+        for (auto &f : restored)
+        {
+            auto it = files.find(f.first);
+            if (it == files.end() || it->second != f.second)
+            {
+                f.second = replayed_fd;
+            }
+        }
+        for (auto &f : files)
+        {
+            if (s.files.find(f.first) == s.files.end() && f.second >= 0)
+            {
+                close(f.second);
+            }
+        }
+        files = restored;
+    }
+
+    ProxyKernel(const std::string &root, double freq_mhz) : root(root), freq_mhz(freq_mhz), input_log(nullptr), muted(false)
+    {
+        brk_start = brk_cur = 0;
+        next_fd = 3;
+        halted = false;
+        exit_code = 0;
+    }
+    ~ProxyKernel()
+    {
+        for (auto &f : files)
+        {
+            if (f.second >= 0)
+            {
+                close(f.second);
+            }
+        }
+    }
+
+    // プログラムの終わり (この後ろをヒープにする)
+    void set_image_end(uint32_t end)
+    {
+        brk_start = brk_cur = (end + 0xfff) & ~0xfffu;
+    }
+
+    void syscall(Register *r, Memory *m, MTIMER *mtimer, Permission perm)
+    {
+        uint32_t a[6];
+        for (int i = 0; i < 6; i++)
+        {
+            a[i] = r->get_ireg(reg_a0 + i);
+        }
+        int32_t ret;
+        switch (r->get_ireg(reg_a7))
+        {
+        case SYS_WRITE:
+            ret = sys_write(m, a[0], a[1], a[2], perm);
+            break;
+        case SYS_READ:
+            ret = sys_read(m, a[0], a[1], a[2], perm);
+            break;
+        case SYS_OPENAT:
+            ret = sys_open(m, a[1], a[2], a[3], perm);
+            break;
+        case SYS_OPEN:
+            ret = sys_open(m, a[0], a[1], a[2], perm);
+            break;
+        case SYS_CLOSE:
+            ret = sys_close(a[0]);
+            break;
+        case SYS_LSEEK:
+            ret = sys_lseek(a[0], a[1], a[2]);
+            break;
+        case SYS_GETTIMEOFDAY:
+            ret = sys_gettimeofday(m, mtimer, a[0], perm);
+            break;
+        case SYS_BRK:
+            ret = sys_brk(a[0]);
+            break;
+        case SYS_EXIT:
+        case SYS_EXIT_GROUP:
+            halted = true;
+            exit_code = a[0];
+            return;
+        default:
+            warn_dump("対応していないシステムコールです: %u\n", r->get_ireg(reg_a7));
+            ret = -ENOSYS;
+            break;
+        }
+        r->set_ireg(reg_a0, ret);
+    }
+};
@@ -0,0 +1,82 @@
+// 仮想時間 (mtime) の進め方の設定
+// 命令クラス (pipeline.cpp の PipeClass) 毎のコストと、命令フェッチ・MMIOデバイスのコスト
+class TimingConfig
+{
+  public:
+    uint32_t class_cost[PIPE_CLASS_NUM];
+    uint32_t fetch;
+    uint32_t uart;
+    uint32_t led;
+    uint32_t mtimer;
+
+    // デフォルトはフェッチ・ロード・ストアに40ずつ
+    TimingConfig()
+    {
+        for (int i = 0; i < PIPE_CLASS_NUM; i++)
+        {
+            class_cost[i] = 0;
+        }
+        class_cost[PIPE_LOAD] = 40;
+        class_cost[PIPE_STORE] = 40;
+        fetch = 40;
+        uart = 0;
+        led = 0;
+        mtimer = 0;
+    }
+
+    // 各行は "name cycles"
+    void load(const std::string &filename)
+    {
+        std::ifstream ifs(filename);
+        if (!ifs)
+        {
+            error_dump("タイミング設定を開けませんでした: %s\n", filename.c_str());
+        }
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            char buf[32];
+            unsigned cycles;
+            if (sscanf(line.c_str(), "%31s %u", buf, &cycles) != 2 || buf[0] == '#')
+            {
+                continue;
+            }
+            std::string name = buf;
+            if (name == "fetch")
+            {
+                fetch = cycles;
+            }
+            else if (name == "uart")
+            {
+                uart = cycles;
+            }
+            else if (name == "led")
+            {
+                led = cycles;
+            }
+            else if (name == "mtimer")
+            {
+                mtimer = cycles;
+            }
+            else
+            {
+                int c = 0;
+                while (c < PIPE_CLASS_NUM && name != pipe_class_names[c])
+                {
+                    c++;
+                }
+                if (c == PIPE_CLASS_NUM)
+                {
+                    error_dump("知らない命令クラスです: %s\n", name.c_str());
+                }
+                class_cost[c] = cycles;
+            }
+        }
+    }
+
+    // フェッチも含めた1命令のコスト (デコード時に1回だけ計算する)
+    uint32_t cost(const PipeInst &p)
+    {
+        return fetch + class_cost[p.cls];
+    }
+};
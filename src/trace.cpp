@@ -0,0 +1,255 @@
+// バイナリ形式の実行トレース
+// ファイル: TraceHeader の後に TraceRecord が並ぶ (gzip圧縮してもよい)
+// 書き込みはリングバッファ経由で別スレッドが行う
+
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+enum TraceFlag : uint8_t
+{
+    TRACE_MEM_READ = 1 << 0,
+    TRACE_MEM_WRITE = 1 << 1,
+    TRACE_TRAP = 1 << 2,
+};
+
+// rd: 0-31 整数レジスタ, 32-63 浮動小数点レジスタ, trace_no_rd は書き込みなし
+static const uint8_t trace_no_rd = 0xff;
+
+struct TraceRecord
+{
+    uint32_t pc;
+    uint32_t inst;
+    uint32_t wb;   // rdへの書き込み値
+    uint32_t addr; // メモリアクセスの仮想アドレス
+    uint32_t data; // ストアした値
+    uint8_t rd;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+static const char trace_magic[8] = {'E', 'M', 'U', 'T', 'R', 'A', 'C', 'E'};
+static const uint32_t trace_version = 1;
+
+// 書き込み先のレジスタ (trace_no_rd なら書き込まない命令)
+uint8_t trace_dest(Decoder *d)
+{
+    switch (static_cast<Inst>(d->opcode()))
+    {
+    case Inst::LUI:
+    case Inst::AUIPC:
+    case Inst::JAL:
+    case Inst::JALR:
+    case Inst::LOAD:
+    case Inst::ALUI:
+    case Inst::ALU:
+        return d->rd();
+    case Inst::SYSTEM:
+        return static_cast<System_Inst>(d->funct3()) == System_Inst::PRIV ? trace_no_rd : d->rd();
+    case Inst::FLOAD:
+    case Inst::FMADD:
+    case Inst::FMSUB:
+    case Inst::FNMSUB:
+    case Inst::FNMADD:
+        return 32 + d->rd();
+    case Inst::FPU:
+        switch (static_cast<FPU_Inst>(d->funct5_fmt()))
+        {
+        case FPU_Inst::FCVT_W_S:
+        case FPU_Inst::FCOMP:
+        case FPU_Inst::FMV_X_W:
+            return d->rd();
+        default:
+            return 32 + d->rd();
+        }
+    default:
+        return trace_no_rd;
+    }
+}
+
+// tracedump と cosim で共通の1行表示
+void print_trace_record(unsigned long long n, const TraceRecord &rec, Disasm *disasm)
+{
+    printf("%llu %08x %08x ", n, rec.pc, rec.inst);
+    if (rec.flags & TRACE_TRAP)
+    {
+        printf("trap ");
+    }
+    else if (rec.rd != trace_no_rd)
+    {
+        printf("%s%d=%08x ", rec.rd < 32 ? "x" : "f", rec.rd % 32, rec.wb);
+    }
+    if (rec.flags & TRACE_MEM_READ)
+    {
+        printf("[%08x] ", rec.addr);
+    }
+    if (rec.flags & TRACE_MEM_WRITE)
+    {
+        printf("[%08x]<-%08x ", rec.addr, rec.data);
+    }
+    Decoder d(rec.inst);
+    disasm->decode(&d);
+    printf("%s\n", disasm->inst_string(disasm->type).c_str());
+}
+
+class TraceWriter
+{
+    static const uint64_t ring_size = 1 << 16;
+    static const uint64_t publish_interval = 256;
+
+    std::vector<TraceRecord> ring;
+    // producer(エミュレータ) と consumer(書き込みスレッド) で別のキャッシュラインに置く
+    // C++14 の new は alignas(64) を守らないので、間を1ライン分空ける
+    static const size_t line_size = 64;
+    std::atomic<uint64_t> head;
+    char pad_head[line_size];
+    std::atomic<uint64_t> tail;
+    char pad_tail[line_size];
+    uint64_t local_head;
+    uint64_t cached_tail;
+    std::atomic<bool> closing;
+
+    FILE *fp;
+    gzFile gz;
+    std::thread writer;
+
+    void write_out(const void *buf, size_t size)
+    {
+        if (gz)
+        {
+            gzwrite(gz, buf, size);
+        }
+        else
+        {
+            fwrite(buf, 1, size, fp);
+        }
+    }
+
+    void consume()
+    {
+        while (1)
+        {
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            uint64_t h = head.load(std::memory_order_acquire);
+            if (h == t)
+            {
+                if (closing.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t)
+                {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            // 折り返しまでの連続領域をまとめて書く
+            uint64_t n = std::min(h - t, ring_size - (t & (ring_size - 1)));
+            write_out(&ring[t & (ring_size - 1)], n * sizeof(TraceRecord));
+            tail.store(t + n, std::memory_order_release);
+        }
+    }
+
+  public:
+    TraceWriter(const std::string &filename, int compress_level)
+        : ring(ring_size), head(0), tail(0), local_head(0), cached_tail(0), closing(false), fp(nullptr), gz(nullptr)
+    {
+        if (compress_level > 0)
+        {
+            char mode[8];
+            snprintf(mode, sizeof(mode), "wb%d", std::min(compress_level, 9));
+            gz = gzopen(filename.c_str(), mode);
+        }
+        else
+        {
+            fp = fopen(filename.c_str(), "wb");
+        }
+        if (fp == nullptr && gz == nullptr)
+        {
+            error_dump("トレースファイルを開けませんでした: %s\n", filename.c_str());
+        }
+        TraceHeader h;
+        memcpy(h.magic, trace_magic, sizeof(h.magic));
+        h.version = trace_version;
+        h.record_size = sizeof(TraceRecord);
+        write_out(&h, sizeof(h));
+        writer = std::thread(&TraceWriter::consume, this);
+    }
+    ~TraceWriter()
+    {
+        close();
+    }
+
+    void push(const TraceRecord &rec)
+    {
+        if (local_head - cached_tail >= ring_size)
+        {
+            head.store(local_head, std::memory_order_release);
+            while (local_head - (cached_tail = tail.load(std::memory_order_acquire)) >= ring_size)
+            {
+                std::this_thread::yield();
+            }
+        }
+        ring[local_head & (ring_size - 1)] = rec;
+        local_head++;
+        if ((local_head & (publish_interval - 1)) == 0)
+        {
+            head.store(local_head, std::memory_order_release);
+        }
+    }
+
+    void close()
+    {
+        if (!writer.joinable())
+        {
+            return;
+        }
+        head.store(local_head, std::memory_order_release);
+        closing.store(true, std::memory_order_release);
+        writer.join();
+        if (gz)
+        {
+            gzclose(gz);
+        }
+        else
+        {
+            fclose(fp);
+        }
+    }
+};
+
+class TraceReader
+{
+    gzFile gz;
+
+  public:
+    TraceReader(const std::string &filename)
+    {
+        // gzreadは圧縮されていないファイルもそのまま読める
+        gz = gzopen(filename.c_str(), "rb");
+        if (gz == nullptr)
+        {
+            error_dump("トレースファイルを開けませんでした: %s\n", filename.c_str());
+        }
+        TraceHeader h;
+        if (gzread(gz, &h, sizeof(h)) != sizeof(h) || memcmp(h.magic, trace_magic, sizeof(h.magic)) != 0)
+        {
+            error_dump("トレースファイルではありません: %s\n", filename.c_str());
+        }
+        if (h.version != trace_version || h.record_size != sizeof(TraceRecord))
+        {
+            error_dump("トレースファイルのバージョンが違います: %u\n", h.version);
+        }
+    }
+    ~TraceReader()
+    {
+        gzclose(gz);
+    }
+
+    // 読めたレコード数を返す
+    size_t read(TraceRecord *buf, size_t n)
+    {
+        int bytes = gzread(gz, buf, n * sizeof(TraceRecord));
+        return bytes <= 0 ? 0 : bytes / sizeof(TraceRecord);
+    }
+};
@@ -0,0 +1,92 @@
+// emu の --trace で書いたバイナリトレースを読める形で表示する
+// ./tracedump trace.bin [開始番号] [件数] [--elf=FILE]
+// --elf を付けると、関数に入る度にその ELF のシンボル名を出す
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdarg.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include "inst.hpp"
+#include "dump.cpp"
+#include "decoder.cpp"
+#include "disasm.cpp"
+#include "trace.cpp"
+#include "elf.cpp"
+
+int main(int argc, const char **argv)
+{
+    std::vector<const char *> args;
+    std::string elf_file;
+    for (int i = 0; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--elf=", 6) == 0)
+        {
+            elf_file = argv[i] + 6;
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    argc = args.size();
+    if (argc == 1)
+    {
+        std::cout << "Usage: " << args[0] << " trace file [start] [count] [--elf=FILE]" << std::endl;
+        return 0;
+    }
+    unsigned long long start = argc <= 2 ? 0 : strtoull(args[2], NULL, 0);
+    unsigned long long count = argc <= 3 ? ~0ULL : strtoull(args[3], NULL, 0);
+    try
+    {
+        SymbolTable symbols;
+        if (elf_file != "")
+        {
+            ElfFile elf(elf_file);
+            elf.read_symbols(&symbols);
+        }
+        TraceReader reader(args[1]);
+        Disasm disasm;
+        std::vector<TraceRecord> buf(4096);
+        unsigned long long n = 0;
+        const Symbol *last = nullptr;
+        size_t got;
+        while (count > 0 && (got = reader.read(buf.data(), buf.size())) > 0)
+        {
+            for (size_t i = 0; i < got && count > 0; i++, n++)
+            {
+                if (n < start)
+                {
+                    continue;
+                }
+                count--;
+                if (!symbols.empty())
+                {
+                    const Symbol *sym = symbols.find(buf[i].pc);
+                    if (sym != last && sym != nullptr)
+                    {
+                        printf("<%s>:\n", symbols.describe(buf[i].pc).c_str());
+                    }
+                    last = sym;
+                }
+                print_trace_record(n, buf[i], &disasm);
+            }
+        }
+        fflush(stdout);
+    }
+    catch (int e)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+#!/bin/bash
+# テストのプログラムをアセンブルし直す (llvm-mc が必要、bench/asm.sh と同じ)
+# ./asm.sh [name...]  (省略すると全部)
+cd "$(dirname "$0")"
+names="$@"
+[ -z "$names" ] && names="$(ls *.s | sed 's/\.s$//')"
+for name in $names
+do
+    llvm-mc -triple=riscv32 -mattr=+m,+f,-relax -filetype=obj "$name.s" -o "$name.o" || exit 1
+    llvm-objcopy -O binary -j .text "$name.o" "$name.bin" || exit 1
+    rm -f "$name.o"
+done
@@ -0,0 +1,60 @@
+# 融合した addi sp + lw/sw の2命令目で起きたトラップ
+# 1命令目 (addi sp) は済んでいて、sepc は2命令目を指すこと
+# ハンドラは scause, sepc, stval を出して次の命令から再開する
+.text
+_start:
+  li sp, 0x100000
+  la t0, handler
+  slli t0, t0, 2
+  csrw stvec, t0
+  li s0, 0x100000
+  # addi sp + lw (lw が 0x100000-16+2 でずれる)
+  addi sp, sp, -16
+  lw a1, 2(sp)
+  sub a0, s0, sp
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  # addi sp + sw (sw が 0x100000-32+6 でずれる)
+  addi sp, sp, -16
+  sw a1, 6(sp)
+  sub a0, s0, sp
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  # ずれていなければそのまま融合して進む
+  li a1, 1234
+  addi sp, sp, 32
+  sw a1, -4(sp)
+  addi sp, sp, -8
+  lw a0, 4(sp)
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+handler:
+  addi sp, sp, -8
+  sw ra, 0(sp)
+  sw a0, 4(sp)
+  csrr a0, scause
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  csrr a0, sepc
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  csrr a0, stval
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  csrr a0, sepc
+  addi a0, a0, 4
+  csrw sepc, a0
+  lw ra, 0(sp)
+  lw a0, 4(sp)
+  addi sp, sp, 8
+  sret
+
+.include "../../bench/lib.s"
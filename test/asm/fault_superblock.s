@@ -0,0 +1,67 @@
+# スーパーブロックになったループの途中で起きたトラップ
+# 600回目だけ lw のアドレスが2ずれる。128回に1回は分岐が逆に行ってサイドイグジットする
+# ハンドラは scause, sepc, stval と何回目かを出して次の命令から再開する
+.text
+_start:
+  li sp, 0x100000
+  la t0, handler
+  slli t0, t0, 2
+  csrw stvec, t0
+  li s0, 0x10000
+  li s1, 0
+  li s2, 1000
+  li s3, 0
+  li s4, 0
+1:
+  xori s5, s1, 600
+  seqz s5, s5
+  slli s5, s5, 1
+  add s5, s5, s0
+  sw s1, 0(s0)
+  lw s6, 0(s5)
+  add s3, s3, s6
+  andi s7, s1, 127
+  bnez s7, 2f
+  addi s4, s4, 1
+2:
+  addi s1, s1, 1
+  blt s1, s2, 1b
+  mv a0, s3
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  mv a0, s4
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+handler:
+  addi sp, sp, -8
+  sw ra, 0(sp)
+  sw a0, 4(sp)
+  csrr a0, scause
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  csrr a0, sepc
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  csrr a0, stval
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  mv a0, s1
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  csrr a0, sepc
+  addi a0, a0, 4
+  csrw sepc, a0
+  lw ra, 0(sp)
+  lw a0, 4(sp)
+  addi sp, sp, 8
+  sret
+
+.include "../../bench/lib.s"
@@ -0,0 +1,62 @@
+# fmadd/fmsub/fnmsub/fnmadd を fma_ref.c (ホストの fmaf) と比べる
+# 標準入力から個数 (4バイト) と、1件ごとに rs1, rs2, rs3 (4バイトずつ、リトルエンディアン) を読み、
+# 4つの結果のビット列を10進数で1行に出す
+.text
+_start:
+  li sp, 0x100000
+  li s0, 0x10000
+  jal ra, getw
+  mv s1, a0
+1:
+  beqz s1, 2f
+  jal ra, getw
+  sw a0, 0(s0)
+  jal ra, getw
+  sw a0, 4(s0)
+  jal ra, getw
+  sw a0, 8(s0)
+  flw fa1, 0(s0)
+  flw fa2, 4(s0)
+  flw fa3, 8(s0)
+  fmadd.s fa0, fa1, fa2, fa3, rne
+  fsw fa0, 16(s0)
+  fmsub.s fa0, fa1, fa2, fa3, rne
+  fsw fa0, 20(s0)
+  fnmsub.s fa0, fa1, fa2, fa3, rne
+  fsw fa0, 24(s0)
+  fnmadd.s fa0, fa1, fa2, fa3, rne
+  fsw fa0, 28(s0)
+  addi s2, s0, 16
+  addi s3, s0, 32
+3:
+  lw a0, 0(s2)
+  jal ra, print_int
+  addi s2, s2, 4
+  li a0, 32
+  beq s2, s3, 4f
+  jal ra, putc
+  j 3b
+4:
+  li a0, 10
+  jal ra, putc
+  addi s1, s1, -1
+  j 1b
+2:
+  .word 0
+
+# 標準入力から4バイト (リトルエンディアン) 読んで a0 に返す
+getw:
+  mv s4, ra
+  li s5, 0
+  li s6, 0
+5:
+  jal ra, getc
+  sll a0, a0, s6
+  or s5, s5, a0
+  addi s6, s6, 8
+  li t0, 32
+  bne s6, t0, 5b
+  mv a0, s5
+  jr s4
+
+.include "../../bench/lib.s"
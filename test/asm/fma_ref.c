@@ -0,0 +1,154 @@
+// fma.s の入力と、期待する出力をホストの fmaf で作る
+//   fma_ref in   fma.bin の標準入力にするバイト列
+//   fma_ref out  fma.bin が出すはずの行
+// エミュレータの FPU に合わせて、非正規化数の入力は 0 として扱い、
+// 結果が非正規化数になったら符号付きの 0、NaN は 0x7fc00000 にする
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static float from_bits(uint32_t x) {
+  float f;
+  memcpy(&f, &x, 4);
+  return f;
+}
+
+static uint32_t to_bits(float f) {
+  uint32_t x;
+  memcpy(&x, &f, 4);
+  return x;
+}
+
+static float ftz(float f) {
+  uint32_t x = to_bits(f);
+  if ((x & 0x7f800000) == 0) {
+    return from_bits(x & 0x80000000);
+  }
+  return f;
+}
+
+static uint32_t result(float f) {
+  uint32_t x = to_bits(f);
+  if (isnan(f)) {
+    return 0x7fc00000;
+  }
+  if ((x & 0x7f800000) == 0) {
+    return x & 0x80000000;
+  }
+  return x;
+}
+
+// 丸めの境目、非正規化数と下位桁あふれ、桁落ち、inf/NaN
+static const uint32_t cases[][3] = {
+    // (1+2^-12)^2 = 1+2^-11+2^-24 はちょうど中間。偶数に丸める / c のわずかな値で上下に倒れる
+    {0x3f800800, 0x3f800800, 0x00000000},
+    {0x3f800800, 0x3f800800, 0x21800000},
+    {0x3f800800, 0x3f800800, 0xa1800000},
+    {0x3f800801, 0x3f800801, 0x00000000},
+    {0x3f800001, 0x3f800001, 0xbf800000},
+    {0x3f7fffff, 0x3f7fffff, 0x33800000},
+    {0x3f7fffff, 0x3f800001, 0xbf800000},
+    // 非正規化数の入力
+    {0x00000001, 0x3f800000, 0x3f800000},
+    {0x007fffff, 0x4b000000, 0x00000000},
+    {0x3f800000, 0x00400000, 0x80000000},
+    {0x3f800000, 0x3f800000, 0x007fffff},
+    {0x80000001, 0x7f000000, 0x00000000},
+    // 結果が非正規化数・最小の正規化数
+    {0x1c800000, 0x1c800000, 0x00000000},
+    {0x1f800000, 0x20000000, 0x00000000},
+    {0x9c800000, 0x1c800000, 0x00000000},
+    {0x00800000, 0x3f000000, 0x00000000},
+    {0x00800000, 0x3f800000, 0x80800000},
+    {0x00c00000, 0x3f800000, 0x80800000},
+    {0x01000000, 0x3f000000, 0x80000000},
+    // 桁落ち
+    {0x40400000, 0x3eaaaaab, 0xbf800000},
+    {0x3dcccccd, 0x41200000, 0xbf800000},
+    {0x3f8ccccd, 0x3f8ccccd, 0xbf9eb852},
+    {0x3f800000, 0x3f800000, 0xbf800000},
+    {0xbf800000, 0x3f800000, 0x3f800000},
+    {0x4b7fffff, 0x3f800000, 0xcb7ffffe},
+    // 大きい値・あふれ
+    {0x7f000000, 0x40000000, 0x00000000},
+    {0x7f7fffff, 0x3f800000, 0x7f7fffff},
+    {0x7f7fffff, 0x3f800000, 0x73800000},
+    {0x7f7fffff, 0xbf800000, 0x7f7fffff},
+    // inf と NaN
+    {0x7f800000, 0x00000000, 0x00000000},
+    {0x7f800000, 0x3f800000, 0xff800000},
+    {0x7f800000, 0x3f800000, 0x7f800000},
+    {0x3f800000, 0x3f800000, 0x7f800000},
+    {0x7fc00000, 0x3f800000, 0x3f800000},
+    {0x3f800000, 0x7f800001, 0x3f800000},
+    {0x3f800000, 0x3f800000, 0xffc00000},
+    // 0 の符号
+    {0x00000000, 0x3f800000, 0x80000000},
+    {0x80000000, 0x3f800000, 0x80000000},
+    {0x80000000, 0x80000000, 0x00000000},
+};
+
+// 残りは乱数 (指数は狭い範囲に寄せて、加算と桁落ちが起きるようにする)
+static const int n_random = 400;
+
+static uint32_t xorshift(uint32_t *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 17;
+  *s ^= *s << 5;
+  return *s;
+}
+
+static uint32_t random_float(uint32_t *s, int center) {
+  uint32_t r = xorshift(s);
+  uint32_t e = center + (int)(xorshift(s) % 48) - 24;
+  return (r & 0x80000000) | (e << 23) | (r & 0x7fffff);
+}
+
+static void make_case(int i, uint32_t *s, uint32_t v[3]) {
+  int n_fixed = sizeof(cases) / sizeof(cases[0]);
+  if (i < n_fixed) {
+    memcpy(v, cases[i], sizeof(cases[i]));
+    return;
+  }
+  // 何件かおきに、積と足す数をほぼ打ち消し合うようにする
+  v[0] = random_float(s, 127);
+  v[1] = random_float(s, 127);
+  if (i % 4 == 0) {
+    v[2] = to_bits(-from_bits(v[0]) * from_bits(v[1]));
+    v[2] ^= xorshift(s) & 3;
+  } else {
+    v[2] = random_float(s, 127 + 16 - (int)(xorshift(s) % 32));
+  }
+}
+
+static void put_word(uint32_t x) {
+  for (int i = 0; i < 4; i++) {
+    putchar((x >> (8 * i)) & 0xff);
+  }
+}
+
+int main(int argc, char **argv) {
+  int in = argc > 1 && strcmp(argv[1], "in") == 0;
+  int n = sizeof(cases) / sizeof(cases[0]) + n_random;
+  uint32_t s = 2463534242u;
+  if (in) {
+    put_word(n);
+  }
+  for (int i = 0; i < n; i++) {
+    uint32_t v[3];
+    make_case(i, &s, v);
+    if (in) {
+      put_word(v[0]);
+      put_word(v[1]);
+      put_word(v[2]);
+      continue;
+    }
+    float a = ftz(from_bits(v[0]));
+    float b = ftz(from_bits(v[1]));
+    float c = ftz(from_bits(v[2]));
+    printf("%u %u %u %u\n", result(fmaf(a, b, c)), result(fmaf(a, b, -c)),
+           result(fmaf(-a, b, c)), result(fmaf(-a, b, -c)));
+  }
+  return 0;
+}
@@ -0,0 +1,55 @@
+# --pk のサンドボックスから出られないこと
+# check.sh が root/dir/data (中身 "ok")、root/esc -> 外のディレクトリ、root/link -> 外のファイル を作る
+# 開けたら中身を、開けなければ "denied" を出す
+.text
+_start:
+  jal s0, 1f
+  .asciz "esc/secret"
+  .asciz "link"
+  .asciz "dir/data"
+  .asciz "denied\n"
+  .byte 0, 0, 0
+1:
+  mv a0, s0
+  jal ra, show
+  addi a0, s0, 11
+  jal ra, show
+  addi a0, s0, 16
+  jal ra, show
+  # exit(0)
+  li a0, 0
+  li a7, 93
+  ecall
+  .word 0
+
+# a0 のパスを open して中身を write(1) する
+show:
+  mv s1, ra
+  li a1, 0
+  li a2, 0
+  li a7, 1024
+  ecall
+  bltz a0, 2f
+  mv s2, a0
+  addi sp, sp, -64
+  mv a1, sp
+  li a2, 64
+  li a7, 63
+  ecall
+  mv a2, a0
+  li a0, 1
+  mv a1, sp
+  li a7, 64
+  ecall
+  addi sp, sp, 64
+  mv a0, s2
+  li a7, 57
+  ecall
+  jr s1
+2:
+  li a0, 1
+  addi a1, s0, 25
+  li a2, 7
+  li a7, 64
+  ecall
+  jr s1
@@ -0,0 +1,63 @@
+# タイマ割り込みが入るループ (スーパーブロックと融合する命令の組を含む)
+# 割り込みが入る位置が --no-superblock --no-fusion のときと同じになること
+# ハンドラは回数を数え、mtimecmp を進めて sip を落とす
+.text
+_start:
+  li sp, 0x100000
+  la t0, handler
+  slli t0, t0, 2
+  csrw stvec, t0
+  li s0, 0x80001000
+  li s1, 0
+  li s2, 100000
+  li s3, 0
+  li s9, 0
+  li s10, 0
+  li s8, 100000
+  sw zero, 12(s0)
+  lw t0, 0(s0)
+  add t0, t0, s8
+  sw t0, 8(s0)
+  li t0, 0x20
+  csrs sie, t0
+  csrsi sstatus, 2
+1:
+  lui s4, 0x12345
+  addi s4, s4, 0x678
+  xor s3, s3, s4
+  add s3, s3, s1
+  addi sp, sp, -4
+  sw s3, 0(sp)
+  addi sp, sp, 4
+  lw s5, -4(sp)
+  add s3, s3, s5
+  addi s1, s1, 1
+  blt s1, s2, 1b
+  mv a0, s3
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  mv a0, s9
+  jal ra, print_int
+  li a0, 32
+  jal ra, putc
+  mv a0, s10
+  jal ra, print_int
+  li a0, 10
+  jal ra, putc
+  .word 0
+
+# s8: 割り込みの間隔、s9: 割り込みの回数、s10: 割り込まれた位置 (sepc) の和
+# 割り込まれた側のレジスタは s11 しか使わない
+handler:
+  addi s9, s9, 1
+  csrr s11, sepc
+  add s10, s10, s11
+  lw s11, 0(s0)
+  add s11, s11, s8
+  sw s11, 8(s0)
+  li s11, 0x20
+  csrc sip, s11
+  sret
+
+.include "../../bench/lib.s"
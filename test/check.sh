@@ -0,0 +1,73 @@
+#!/bin/bash
+# make check から呼ばれる、エミュレータ自身のテスト (min-caml は要らない)
+# asm/ のプログラムを実行して、出力を asm/*.out と比べる
+# プログラムを変えたら asm/asm.sh で *.bin を作り直す (llvm-mc が必要)
+
+cd "$(dirname "$0")"
+make -C .. build > /dev/null 2>&1 || { echo "build failed"; exit 1; }
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+
+status=0
+
+function check {
+    if cmp -s "$2" "$3"
+    then
+        echo -e "$1...\033[0;32mok\033[0;39m"
+    else
+        echo -e "$1...\033[0;31m[Error]\033[0;39m"
+        diff "$3" "$2" | head -20
+        status=1
+    fi
+}
+
+# --pk: 途中のディレクトリや最後のファイルがシンボリックリンクなら root の外でも開かない
+mkdir -p "$tmp/root/dir" "$tmp/outside"
+echo ok > "$tmp/root/dir/data"
+echo secret > "$tmp/outside/secret"
+ln -s "$tmp/outside" "$tmp/root/esc"
+ln -s "$tmp/outside/secret" "$tmp/root/link"
+../emu asm/pk_escape.bin h --pk="$tmp/root" < /dev/null > "$tmp/out" 2> /dev/null
+check pk_escape "$tmp/out" asm/pk_escape.out
+
+# --pk の read: 大きな長さを渡しても一部ずつ、標準入力は1行ずつ返る
+printf 'ab\ncd\nlast' | ../emu asm/pk_read.bin h --pk > "$tmp/out" 2> /dev/null
+check pk_read "$tmp/out" asm/pk_read.out
+
+# --cosim: 最後の (batch に満たない) 分で食い違っても終了コードが 0 にならない
+printf 'ab\ncd\nlast' > "$tmp/in"
+../emu asm/pk_read.bin h --pk --trace="$tmp/trace" < "$tmp/in" > /dev/null 2>&1
+../emu asm/pk_read.bin h --pk --cosim="$tmp/trace" < "$tmp/in" > /dev/null 2>&1
+echo $? > "$tmp/out"
+# 最後から3つ目の記録の wb を書き換える
+printf '\377' | dd of="$tmp/trace" bs=1 seek=$(( $(stat -c %s "$tmp/trace") - 64 )) conv=notrunc 2> /dev/null
+../emu asm/pk_read.bin h --pk --cosim="$tmp/trace" < "$tmp/in" > /dev/null 2>&1
+echo $? >> "$tmp/out"
+printf '0\n255\n' > "$tmp/expected"
+check cosim_last_batch "$tmp/out" "$tmp/expected"
+
+# トラップと割り込み: 融合した組の2命令目、スーパーブロックの途中でのトラップと、タイマ割り込み
+for p in fault_fused fault_superblock timer_intr
+do
+    ../emu asm/$p.bin h < /dev/null > "$tmp/out" 2> /dev/null
+    check $p "$tmp/out" asm/$p.out
+done
+
+# fmadd/fmsub/fnmsub/fnmadd: 丸めの境目、非正規化数、桁落ちを含む入力で、ホストの fmaf と比べる
+cc -O2 -o "$tmp/fma_ref" asm/fma_ref.c -lm || { echo "fma_ref: build failed"; exit 1; }
+"$tmp/fma_ref" in | ../emu asm/fma.bin h > "$tmp/out" 2> /dev/null
+"$tmp/fma_ref" out > "$tmp/expected"
+check fma "$tmp/out" "$tmp/expected"
+
+# 融合とスーパーブロックを切っても、出力・レジスタ・命令数 (h なしの最後の表示) が変わらない
+for p in ../bench/fib ../bench/matmul ../bench/mandelbrot ../bench/sieve ../bench/readsum asm/fault_fused asm/fault_superblock asm/timer_intr
+do
+    input=/dev/null
+    [ -f "$p.in" ] && input="$p.in"
+    ../emu $p.bin < "$input" > "$tmp/fast" 2> /dev/null
+    ../emu $p.bin --no-superblock --no-fusion < "$input" > "$tmp/slow" 2> /dev/null
+    check "$(basename $p) (--no-superblock --no-fusion)" "$tmp/fast" "$tmp/slow"
+done
+
+exit $status